@@ -4,15 +4,24 @@
  *     APA102 LED chain rendering support library.
  *
  ****************************************************************************/
+#define _GNU_SOURCE  /* CPU affinity */
 #include <stdint.h>
 #include <string.h>
 #include <malloc.h>
+#include <time.h>
+#include <unistd.h>
+#include <sched.h>
+#include <sys/mman.h>
+#include <sys/eventfd.h>
 #include "colors.h"
 #include "fifo.h"
 #include "sync_fifo.h"
+#include "spsc_fifo.h"
 #include "debug.h"
 #include "apa102spi.h"
 #include "apa102.h"
+#include "blend.h"
+#include "apa102_inline.h"
 
 
 /*****************************************************************************
@@ -27,12 +36,15 @@
 #define FRAME_START_LEN  (32 / 8) /* 32 bits for frame start */
 #define FRAME_START_POS  0
 #define FRAME_DATA_POS   FRAME_START_LEN
-#define FRAME_COUNT      8
 
-#define BRIGHT_MAX  31
-#define BRIGHT_MASK 0x1f
-#define BRIGHT_RAW  0xe0
-#define BRIGHT_PICK(desired, def) (((desired) <= (BRIGHT_MAX)) ? (desired) : ((def) & BRIGHT_MASK))
+#define ARENA_ALIGN      64                 /* cache line, every buffer starts at one */
+#define HUGEPAGE_LEN     (2 * 1024 * 1024)  /* MAP_HUGETLB default size               */
+#define FRAME_COUNT_DEF  8
+#define FRAME_COUNT_MIN  2
+#define FRAME_COUNT_MBX  3  /* mailbox: one on wire, one rendered, one waiting */
+
+#define RT_SCHED         0x1  /* renderer attributes, create_renderer() */
+#define RT_AFFINITY      0x2
 
 
 /*****************************************************************************
@@ -42,12 +54,19 @@ static int       get_frame_data_len(apa102_t *self);
 static int       get_frame_end_pos (apa102_t *self);
 static int       get_frame_end_len (apa102_t *self);
 static int       get_frame_len     (apa102_t *self);
-static uint8_t **create_frames     (apa102_t *self);
-static void      delete_frames     (apa102_t *self);
+static size_t    layout_arena      (apa102_t *self, uint8_t *base);
+static int       create_arena      (apa102_t *self);
+static void      delete_arena      (apa102_t *self);
+static int       get_canvas_size   (apa102_t *self);
 static void      write_frame_start (apa102_t *self, uint8_t *frame);
 static void      write_frame_data  (apa102_t *self, uint8_t *frame);
 static void      write_frame_end   (apa102_t *self, uint8_t *frame);
 static int       get_pixel_pos     (apa102_t *self, int pixel);
+static void      queue_init        (apa102_queue_t *queue, bool is_lockfree, int size, char *name);
+static void      queue_done        (apa102_queue_t *queue);
+static int       queue_put         (apa102_queue_t *queue, void *item, bool is_waiting);
+static int       queue_get         (apa102_queue_t *queue, void **item, bool is_waiting);
+static int       queue_get_timed   (apa102_queue_t *queue, void **item, int timeout_ms);
 
 
 /*****************************************************************************
@@ -67,7 +86,7 @@ static int get_frame_end_pos(apa102_t *self)
 }
 
 
-static int get_frame_end_len(apa102_t *self)
+static int get_end_len(int pixel_count)
 {
     /* 
      * align to four byte tuples -----------------------------------------------+
@@ -76,7 +95,21 @@ static int get_frame_end_len(apa102_t *self)
      * minimal bit count required -----------------+    |         |             |
      *                                             |    |         |             |
      *                                             V    V         V             V  */
-    return ((((((self->config->pixel_count + 1) / 2) + 32 + 7) / 8) + 3) / 4) * 4;
+    return ((((((pixel_count + 1) / 2) + 32 + 7) / 8) + 3) / 4) * 4;
+}
+
+
+static int get_frame_end_len(apa102_t *self)
+{
+    return get_end_len(self->config->pixel_count);
+}
+
+
+static int get_prefix_len(apa102_t *self, int pixel_count)
+{
+    int len = FRAME_START_LEN + (pixel_count * PIXEL_LEN) + get_end_len(pixel_count);
+
+    return (len < self->frame_len) ? len : self->frame_len;
 }
 
 
@@ -94,37 +127,135 @@ static void init_frame(apa102_t *self, uint8_t *frame)
 }
 
 
-static uint8_t **create_frames(apa102_t *self)
+static size_t arena_take(size_t *pos, size_t len)
+{
+    size_t at = *pos;
+
+    *pos += (len + ARENA_ALIGN - 1) & ~(size_t)(ARENA_ALIGN - 1);
+
+    return at;
+}
+
+
+/*
+ * All the buffers of the chain in one block, each one cache line aligned.
+ * Without the base just the length is returned, otherwise the pointers are
+ * set up as well.
+ */
+static size_t layout_arena(apa102_t *self, uint8_t *base)
 {
-    int       frame_len = get_frame_len(self);
-    uint8_t **frames    = (uint8_t **)malloc(FRAME_COUNT * sizeof(uint8_t *));
-    int       i;
+    const apa102_config_t *config = self->config;
+    bool                   is_canvas = config->is_canvas || (config->encode == APA102_ENCODE_HDR) || config->is_dither;
+    size_t                 pos       = 0;
+    size_t                 frames    = arena_take(&pos, self->frame_count * sizeof(apa102_frame_t));
+    size_t                 at[5];
+    int                    i;
 
-    self->frame_len = frame_len;
+    if (base != NULL)
+        self->frame_pool = (apa102_frame_t *)(base + frames);
 
-    for (i = 0; i < FRAME_COUNT; ++i)
+    for (i = 0; i < self->frame_count; ++i)
     {
-        uint8_t *frame = (uint8_t *)malloc(frame_len);
+        at[0] = arena_take(&pos, self->frame_len);
+        at[1] = config->is_dither ? arena_take(&pos, get_canvas_size(self)) : 0;
+
+        if (base != NULL)
+        {
+            self->frame_pool[i].data   = base + at[0];
+            self->frame_pool[i].canvas = config->is_dither ? (uint16_t *)(base + at[1]) : NULL;
+        }
+    }
 
-        init_frame(self, frame);
-        frames[i] = frame;
+    /* Canvas frames have the brightness applied, wire ones get it on the way */
+    at[0] = config->is_skip_same ? arena_take(&pos, self->frame_len) : 0;
+    at[1] = is_canvas ? arena_take(&pos, get_canvas_size(self)) : arena_take(&pos, self->frame_len);
+    at[2] = config->is_dither ? arena_take(&pos, get_canvas_size(self)) : 0;
+    at[3] = config->is_dither ? arena_take(&pos, config->pixel_count * CANVAS_LANES) : 0;
+    at[4] = config->is_dither ? arena_take(&pos, self->frame_len) : 0;
+
+    if (base != NULL)
+    {
+        self->last_sent         = config->is_skip_same ? base + at[0] : NULL;
+        self->canvas            = is_canvas ? (uint16_t *)(base + at[1]) : NULL;
+        self->tx_frame          = is_canvas ? NULL : base + at[1];
+        self->dither_src        = config->is_dither ? (uint16_t *)(base + at[2]) : NULL;
+        self->dither_err        = config->is_dither ? base + at[3] : NULL;
+        self->dither_frame.data = config->is_dither ? base + at[4] : NULL;
     }
 
-    return frames;
+    return pos;
 }
 
 
-static void delete_frames(apa102_t *self)
+/*
+ * One mapping, so nothing shares the cache lines with other heap data. It is
+ * touched (prefaulted) and optionally locked here, so the steady state
+ * rendering does not page fault. Hugepages fall back to the normal ones.
+ */
+static int create_arena(apa102_t *self)
 {
-    uint8_t **frames = self->frame_pool;
-    int       i;
+    const apa102_config_t *config = self->config;
+    size_t                 page   = config->is_hugepages ? HUGEPAGE_LEN : (size_t)sysconf(_SC_PAGESIZE);
+    size_t                 len;
+    uint8_t               *base   = MAP_FAILED;
+    int                    i;
+
+    self->frame_len = get_frame_len(self);
+    len             = (layout_arena(self, NULL) + page - 1) & ~(page - 1);
+
+    if (config->is_hugepages)
+    {
+        base = (uint8_t *)mmap(NULL, len, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_POPULATE | MAP_HUGETLB, -1, 0);
+        if (base == MAP_FAILED)
+            DEBUG_MSG(stderr, "No hugepages, using normal ones!\n");
+    }
+
+    if (base == MAP_FAILED)
+        base = (uint8_t *)mmap(NULL, len, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_POPULATE, -1, 0);
+
+    if (base == MAP_FAILED)
+    {
+        DEBUG_MSG(stderr, "Cannot map the frame arena!\n");
+        return -1;
+    }
+
+    memset(base, 0, len);
+    if (config->is_locked && (mlock(base, len) != 0))
+        DEBUG_MSG(stderr, "Cannot lock the frame arena, left unlocked!\n");
 
-    for (i = 0; i < FRAME_COUNT; ++i)
+    self->arena     = base;
+    self->arena_len = len;
+    layout_arena(self, base);
+
+    for (i = 0; i < self->frame_count; ++i)
     {
-        free(frames[i]);
-        frames[i] = NULL;
+        init_frame(self, self->frame_pool[i].data);
+        self->frame_pool[i].finish_ns  = 0;
+        self->frame_pool[i].dirty      = -1;
+        self->frame_pool[i].brightness = 0;
+        self->frame_pool[i].id         = 0;
     }
-    free(frames);
+
+    if (self->tx_frame != NULL)
+        init_frame(self, self->tx_frame);
+
+    return 0;
+}
+
+
+static void delete_arena(apa102_t *self)
+{
+    munmap(self->arena, self->arena_len);
+
+    self->arena             = NULL;
+    self->arena_len         = 0;
+    self->frame_pool        = NULL;
+    self->last_sent         = NULL;
+    self->canvas            = NULL;
+    self->tx_frame          = NULL;
+    self->dither_src        = NULL;
+    self->dither_err        = NULL;
+    self->dither_frame.data = NULL;
 }
 
 
@@ -179,357 +310,1467 @@ static int get_pixel_pos(apa102_t *self, int pixel)
 }
 
 
-static void *renderer(void *arg)
+static void queue_init(apa102_queue_t *queue, bool is_lockfree, int size, char *name)
 {
-    apa102_t *self = (apa102_t *)arg;
+    queue->is_lockfree = is_lockfree;
 
-    self->is_renderer_running = true;
+    if (is_lockfree)
+        spsc_fifo_init(&queue->lockfree, size, name);
+    else
+        sync_fifo_init(&queue->locked, size, name);
+}
 
-    while (true)
-    {
-        void *item = NULL;
 
-        if (   (sync_fifo_get(&self->full_frames, &item, self->is_renderer_running) == 0)
-            && (item != NULL))
-        {
-            uint8_t *frame = (uint8_t *)item;
+static void queue_done(apa102_queue_t *queue)
+{
+    if (queue->is_lockfree)
+        spsc_fifo_done(&queue->lockfree);
+    else
+        sync_fifo_done(&queue->locked);
+}
 
-            DEBUG_DMP(stdout, frame, self->frame_len, 0, "Rendering frame", NULL);
-            apa102spi_update(frame, self->frame_len);
-            sync_fifo_put(&self->free_frames, item, true);
-        }
-        else
-            break;
-    }
 
-    return NULL;
+static int queue_put(apa102_queue_t *queue, void *item, bool is_waiting)
+{
+    return queue->is_lockfree ? spsc_fifo_put(&queue->lockfree, item, is_waiting)
+                              : sync_fifo_put(&queue->locked, item, is_waiting);
 }
 
 
-/*****************************************************************************
- * Public functions
- ****************************************************************************/
+static int queue_get(apa102_queue_t *queue, void **item, bool is_waiting)
+{
+    return queue->is_lockfree ? spsc_fifo_get(&queue->lockfree, item, is_waiting)
+                              : sync_fifo_get(&queue->locked, item, is_waiting);
+}
 
 
-/*************************************************************************//**
- * Initialize the context
- *
- * Some of the context members are supposed to be setup prior this call, the
- * private part is initialized by this.
- *
- * @param[in,out]    self    APA102 chain context
- *
- * @return    zero on success, nonzero otherwise
- *
- ****************************************************************************/
-int apa102_init(apa102_t *self, const apa102_config_t *config)
+static int queue_get_timed(apa102_queue_t *queue, void **item, int timeout_ms)
 {
-    int i;
+    return queue->is_lockfree ? spsc_fifo_get_timed(&queue->lockfree, item, timeout_ms)
+                              : sync_fifo_get_timed(&queue->locked, item, timeout_ms);
+}
 
-    DEBUG_FMT(stderr, "Initializing: %s, %d Hz, %d pix, brightness %d\n", config->spi_device, config->spi_speed, config->pixel_count, config->brightness);
 
-    self->config       = config;
-    self->brightness   = config->brightness;
-    self->active_frame = NULL;
-    self->prev_frame   = NULL;
-    self->frame_pool   = create_frames(self);
+static int queue_count(apa102_queue_t *queue)
+{
+    return queue->is_lockfree ? spsc_fifo_count(&queue->lockfree)
+                              : sync_fifo_count(&queue->locked);
+}
 
-    DEBUG_MSG(stderr, "Preparing FIFOs...\n");
-    sync_fifo_init(&self->free_frames, FRAME_COUNT, "free_frames");
-    sync_fifo_init(&self->full_frames, FRAME_COUNT, "full_frames");
 
-    for (i = 0; i < FRAME_COUNT; ++i)
-    {
-        fifo_put(&self->free_frames.raw, (void *)(self->frame_pool[i]));
-    }
+static uint64_t get_ns(void)
+{
+    struct timespec ts;
 
-    DEBUG_MSG(stderr, "Creating renderer...\n");
-    pthread_create(&self->th_renderer, NULL, renderer, (void *)self);
+    clock_gettime(CLOCK_MONOTONIC, &ts);
 
-    DEBUG_MSG(stderr, "Opening SPI...\n");
-    return apa102spi_open(self->config->spi_device, self->config->spi_speed);
+    return ts.tv_sec * 1000000000ULL + ts.tv_nsec;
 }
 
 
-/*************************************************************************//**
- * Finalize the context
- *
- * Also release any allocated resources.
- *
- * @param[in,out]    self    APA102 chain context
- *
- * @return    zero on success, nonzero otherwise
- *
- ****************************************************************************/
-int apa102_done(apa102_t *self)
+/*
+ * Statistics are written by one thread only (producer or renderer), readers
+ * use the sequence number to get consistent snapshot without any locking.
+ */
+static void stats_begin(apa102_counters_t *counters)
 {
-    int ret = -1;
-
-    DEBUG_MSG(stderr, "Finalizing...\n");
-
-    self->is_renderer_running = false;
+    __atomic_store_n(&counters->seq, counters->seq + 1, __ATOMIC_RELAXED);
+    __atomic_thread_fence(__ATOMIC_RELEASE);
+}
 
-    sync_fifo_put(&self->full_frames, NULL, true);
-    pthread_join(self->th_renderer, NULL);
 
-    ret = apa102spi_close();
+static void stats_end(apa102_counters_t *counters)
+{
+    __atomic_store_n(&counters->seq, counters->seq + 1, __ATOMIC_RELEASE);
+}
 
-    sync_fifo_done(&self->full_frames);
-    sync_fifo_done(&self->free_frames);
 
-    delete_frames(self);
-    self->frame_pool = NULL;
+static void stats_read(apa102_counters_t *counters, apa102_stats_t *stats)
+{
+    uint32_t seq;
 
-    return ret;
+    do
+    {
+        seq = __atomic_load_n(&counters->seq, __ATOMIC_ACQUIRE);
+        memcpy(stats, &counters->stats, sizeof(apa102_stats_t));
+        __atomic_thread_fence(__ATOMIC_ACQUIRE);
+    } while ((seq & 1) || (seq != __atomic_load_n(&counters->seq, __ATOMIC_RELAXED)));
 }
 
 
-/*************************************************************************//**
- * Prepare for rendering of the new frame
- *
- * Any pixel manipulation is supposed to be done between begin/finish frame
- * calls.
- *
- * @param[in,out]    self         APA102 chain context
- * @param[in]        copy_last    Copy the previous frame content or start with
- *                                empty one
- *
- * @return    zero on success, nonzero otherwise
- *
- ****************************************************************************/
-int apa102_begin_frame(apa102_t *self, bool copy_last)
+static void hist_add(apa102_histogram_t *hist, uint64_t ns)
 {
-    void    *item       = NULL;
-    uint8_t *prev_frame = self->prev_frame;
-    uint8_t *curr_frame;
+    uint64_t us     = ns / 1000;
+    int      bucket = (us < 2) ? 0 : (63 - __builtin_clzll(us));
 
-    DEBUG_MSG(stderr, "Starting new frame...\n");
+    if (bucket >= APA102_HIST_BUCKETS)
+        bucket = APA102_HIST_BUCKETS - 1;
 
-    sync_fifo_get(&self->free_frames, &item, true);
-    curr_frame = (uint8_t *)item;
+    if ((hist->count == 0) || (ns < hist->min_ns))
+        hist->min_ns = ns;
+    if (ns > hist->max_ns)
+        hist->max_ns = ns;
 
-    if (copy_last && (prev_frame != NULL))
-        memcpy(item, (void *)prev_frame, self->frame_len);
-    else
-        init_frame(self, curr_frame);
+    hist->count    += 1;
+    hist->total_ns += ns;
+    hist->buckets[bucket] += 1;
+}
 
-    self->active_frame = curr_frame;
 
-    return 0;
+static void hist_finish(apa102_histogram_t *hist)
+{
+    hist->avg_ns = (hist->count > 0) ? (hist->total_ns / hist->count) : 0;
 }
 
 
-/*************************************************************************//**
- * Finish rendering of the frame
- *
- * Finished frame is requested to be renderred (means to be sent over SPI to
- * LEDs).
- *
- * @param[in,out]    self    APA102 chain context
- *
- * @return    zero on success, nonzero otherwise
- *
- ****************************************************************************/
-int apa102_finish_frame(apa102_t *self)
+static bool is_full_needed(apa102_t *self, uint64_t now)
 {
-    uint8_t *curr_frame = self->active_frame;
+    uint64_t keepalive_ns = self->config->keepalive_ms * 1000000ULL;
 
-    self->prev_frame   = curr_frame;
-    self->active_frame = NULL;
+    /* Nothing sent yet or the last transfer failed, LEDs state is unknown */
+    if (self->last_sent_ns == 0)
+        return true;
 
-    return sync_fifo_put(&self->full_frames, (void *)curr_frame, true);
+    return (keepalive_ns > 0) && (now - self->last_sent_ns >= keepalive_ns);
 }
 
 
-/*************************************************************************//**
- * Change pixel color
- *
- * Use the AARRGGBB format for the pixel color, where for AA value above 0x1f is
- * considered to be invalid and the detfault one is used.
- *
- * @param[in,out]    self     APA102 chain context
- * @param[in]        pixel    LED offset in the chain
- * @param[in]        argb     Desired color
- * @param[in]        mode     Pixel combination mode (might need some additional
- *                            love to be more useful)
- *
- * @return    zero on success, nonzero otherwise (pixel out of range)
- *
- ****************************************************************************/
-int apa102_set_pixel(apa102_t *self, int pixel, uint32_t argb, apa102_pix_mode_t mode)
+static bool is_same_as_sent(apa102_t *self, const uint8_t *data)
 {
-    uint8_t *frame = self->active_frame;
-    int      pos   = get_pixel_pos(self, pixel);
-
-    if (frame == NULL)
-    {
-        DEBUG_MSG(stderr, "Frame not started!\n");
-        return -1;
-    }
-
-    if (pos < 0)
-    {
-        DEBUG_FMT(stderr, "Ignoring request to pixel %d, value 0x%08x!\n", pixel, argb);
-        return -2;
-    }
+    return (self->last_sent != NULL) && (memcmp(data, self->last_sent, self->frame_len) == 0);
+}
 
-    
-    DEBUG_FMT(stdout, "Setting pixel %3d, value 0x%02x_%02x_%02x_%02x, pos %d\n", pixel, (argb >> 24) & 0xff, (argb >> 16) & 0xff, (argb >> 8) & 0xff, (argb >> 0) & 0xff, pos);
-    switch (mode)
-    {
-        case APA102_PIX_MODE_COPY:
-            frame[pos + 0] = BRIGHT_RAW | BRIGHT_PICK(COL_ALP(argb), self->brightness);
-            frame[pos + 1] = COL_BLU(argb);
-            frame[pos + 2] = COL_GRN(argb);
-            frame[pos + 3] = COL_RED(argb);
-            break;
 
-        case APA102_PIX_MODE_ADD:
-        {
-            uint8_t bright_old = frame[pos + 0] & BRIGHT_MASK;
-            uint8_t bright_new = BRIGHT_PICK(COL_ALP(argb), self->brightness);
+/*
+ * Pixels following the global brightness get the one valid when the frame
+ * was finished, into the renderer's own buffer. The encoded canvas has it
+ * applied already.
+ */
+static uint8_t *get_tx_data(apa102_t *self, apa102_frame_t *frame)
+{
+    if (self->tx_frame == NULL)
+        return frame->data;
 
-            frame[pos + 0] = BRIGHT_RAW | COL_ADD(bright_old, bright_new, BRIGHT_MAX);
-            frame[pos + 1] = COL_ADD(frame[pos + 1], COL_BLU(argb), 255);
-            frame[pos + 2] = COL_ADD(frame[pos + 2], COL_GRN(argb), 255);
-            frame[pos + 3] = COL_ADD(frame[pos + 3], COL_RED(argb), 255);
-            break;
-        }
+    blend_resolve(self->tx_frame + FRAME_DATA_POS, frame->data + FRAME_DATA_POS, self->config->pixel_count, frame->brightness);
 
-        case APA102_PIX_MODE_SUB:
-        {
-            uint8_t bright_old = frame[pos + 0] & BRIGHT_MASK;
-            uint8_t bright_new = BRIGHT_PICK(COL_ALP(argb), self->brightness);
+    return self->tx_frame;
+}
 
-            frame[pos + 0] = BRIGHT_RAW | COL_SUB(bright_old, bright_new, 1);
-            frame[pos + 1] = COL_SUB(frame[pos + 1], COL_BLU(argb), 1);
-            frame[pos + 2] = COL_SUB(frame[pos + 2], COL_GRN(argb), 1);
-            frame[pos + 3] = COL_SUB(frame[pos + 3], COL_RED(argb), 1);
-            break;
-        }
 
-        case APA102_PIX_MODE_SUB2:
-            frame[pos + 0] = BRIGHT_RAW | BRIGHT_PICK(COL_ALP(argb), self->brightness);
-            frame[pos + 1] = COL_SUB2(frame[pos + 1], COL_BLU(argb), 1, 32);
-            frame[pos + 2] = COL_SUB2(frame[pos + 2], COL_GRN(argb), 1, 32);
-            frame[pos + 3] = COL_SUB2(frame[pos + 3], COL_RED(argb), 1, 32);
-            break;
+static void signal_fd(int fd, uint64_t count)
+{
+    if (write(fd, &count, sizeof(count)) != sizeof(count))
+        DEBUG_MSG(stderr, "Cannot signal eventfd!\n");
+}
 
-        case APA102_PIX_MODE_INV2:
-            frame[pos + 0] = BRIGHT_RAW | BRIGHT_PICK(COL_ALP(argb), self->brightness);
-            frame[pos + 1] = COL_INV2(frame[pos + 1], COL_BLU(argb), 1);
-            frame[pos + 2] = COL_INV2(frame[pos + 2], COL_GRN(argb), 1);
-            frame[pos + 3] = COL_INV2(frame[pos + 3], COL_RED(argb), 1);
-            break;
 
-        case APA102_PIX_MODE_XOR:
-            frame[pos + 0] = BRIGHT_RAW | BRIGHT_PICK(COL_ALP(argb), self->brightness);
-            frame[pos + 1] ^= COL_BLU(argb);
-            frame[pos + 2] ^= COL_GRN(argb);
-            frame[pos + 3] ^= COL_RED(argb);
-            break;
-    }
+/*
+ * Frame goes back to the producer, the free frames' eventfd tells so.
+ */
+static void release_frame(apa102_t *self, apa102_frame_t *frame)
+{
+    queue_put(&self->free_frames, frame, true);
 
-    return 0;
+    if (self->free_fd >= 0)
+        signal_fd(self->free_fd, 1);
 }
 
 
-/*************************************************************************//**
- * Get the current pixel color
- *
- * @param[in,out]    self     APA102 chain context
- * @param[in]        pixel    LED offset in the chain
- * @param[out]       argb     Read color
- *
- * @return    zero on success, nonzero otherwise (pixel out of range)
- *
- ****************************************************************************/
-int apa102_get_pixel(apa102_t *self, int pixel, uint32_t *argb)
+/*
+ * Frames are resolved in order (the mailbox drops just the older ones), so
+ * the highest resolved id tells the waiters everything up to it is known.
+ */
+static void record_presented(apa102_t *self, apa102_frame_t *frame, apa102_frame_status_t status, uint64_t ns)
 {
-    uint8_t *frame = self->active_frame;
-    int      pos   = get_pixel_pos(self, pixel);
-    int      ret   = 0;
+    apa102_presented_t presented = {.id = frame->id, .status = status, .present_ns = ns};
 
-    if (pos >= 0)
-        *argb = COL_ARGB(BRIGHT_MASK & frame[pos + 0], frame[pos + 3], frame[pos + 2], frame[pos + 1]);
-    else
-        ret = -1;
+    /* Re-dithered repeats are not the producer's frames */
+    if (frame->id == 0)
+        return;
 
-    return ret;
+    pthread_mutex_lock(&self->presented_mx);
+    self->presented[frame->id % APA102_PRESENT_HISTORY] = presented;
+    self->presented_id = frame->id;
+    pthread_cond_broadcast(&self->presented_cv);
+    pthread_mutex_unlock(&self->presented_mx);
+
+    if (self->presented_fd >= 0)
+        signal_fd(self->presented_fd, 1);
+
+    if (self->config->on_presented != NULL)
+        self->config->on_presented(self->config->presented_arg, &presented);
 }
 
 
-/*************************************************************************//**
- * Switch off all LEDs in the chain
- *
- * @param[in,out]    self    APA102 chain context
- *
- ****************************************************************************/
-void apa102_clear(apa102_t *self)
+/*
+ * Frame not going to be sent (superseded in mailbox mode), its changes have
+ * to be sent with the next one.
+ */
+static void drop_frame(apa102_t *self, apa102_frame_t *frame)
 {
-    uint8_t *frame = self->active_frame;
-    int      pos   = FRAME_DATA_POS;
-    int      i;
+    if (frame->dirty > self->pending_dirty)
+        self->pending_dirty = frame->dirty;
 
-    for (i = 0; i <  self->config->pixel_count; ++i)
-    {
-        frame[pos + 0] = 0xe0;
-        frame[pos + 1] = 0x00;
-        frame[pos + 2] = 0x00;
-        frame[pos + 3] = 0x00;
-        pos += 4;
-    }
+    record_presented(self, frame, APA102_FRAME_DROPPED, get_ns());
 }
 
 
-/*************************************************************************//**
- * Change color of all LEDs in the chain
- *
- * @param[in,out]    self    APA102 chain context
- * @param[in]        argb    Desired color
- *
- ****************************************************************************/
-void apa102_fill(apa102_t *self, uint32_t argb)
+static int send_frame(apa102_t *self, apa102_frame_t *frame, int dropped)
 {
-    int i;
+    uint64_t start = get_ns();
+    uint8_t *data  = get_tx_data(self, frame);
+    uint64_t stop;
+    int      len   = self->frame_len;
+    int      ret;
 
-    for (i = 0; i < self->config->pixel_count; ++i)
+    if (!is_full_needed(self, start))
     {
-        apa102_set_pixel(self, i, argb, APA102_PIX_MODE_COPY);
-    }
-}
+        int dirty = (frame->dirty > self->pending_dirty) ? frame->dirty : self->pending_dirty;
 
+        if (   (self->config->is_prefix && (dirty < 0))
+            || is_same_as_sent(self, data))
+        {
+            /* LEDs show this already */
+            self->pending_dirty = -1;
 
-/*************************************************************************//**
- * Change brightness of all LEDs in the chain
- *
- * This updates current frame and also the default value for next frames.
- *
- * @param[in,out]    self          APA102 chain context
- * @param[in]        brightness    Desired brightness level 0-31
- *
- ****************************************************************************/
-void apa102_set_brightness(apa102_t *self, uint8_t brightness)
-{
-    int pos = FRAME_DATA_POS;
-    int i;
+            stats_begin(&self->renderer_stats);
+            self->renderer_stats.stats.frames_dropped += dropped;
+            self->renderer_stats.stats.frames_skipped += 1;
+            stats_end(&self->renderer_stats);
 
-    if (brightness > BRIGHT_MAX)
-        brightness = BRIGHT_MAX;
+            record_presented(self, frame, APA102_FRAME_SKIPPED, start);
 
-    self->brightness = brightness;
+            return 0;
+        }
 
-    if (self->active_frame != NULL)
-    {
-        uint8_t *frame = self->active_frame;
-        uint8_t  raw   = BRIGHT_RAW | brightness;
+        /*
+         * LEDs past the dirty one keep their values, the bytes following the
+         * prefix (serving as the end frame) are their unchanged data anyway.
+         */
+        if (self->config->is_prefix)
+            len = get_prefix_len(self, dirty + 1);
+    }
 
-        for (i = 0; i < self->config->pixel_count; ++i)
+    DEBUG_DMP(stdout, data, len, 0, "Rendering frame", NULL);
+
+    ret  = apa102spi_update(&self->spi, data, len);
+    stop = get_ns();
+
+    /* Renderer running behind the transfers shows up as uneven intervals */
+    if (self->last_start_ns != 0)
+    {
+        stats_begin(&self->renderer_stats);
+        hist_add(&self->renderer_stats.stats.interval, start - self->last_start_ns);
+        stats_end(&self->renderer_stats);
+    }
+    self->last_start_ns = start;
+
+    /* Failed transfer leaves the LEDs in unknown state, force full next one */
+    self->last_sent_ns  = (ret == 0) ? stop : 0;
+    self->pending_dirty = -1;
+    if ((ret == 0) && (self->last_sent != NULL))
+        memcpy(self->last_sent, data, self->frame_len);
+
+    stats_begin(&self->renderer_stats);
+    {
+        apa102_stats_t *stats = &self->renderer_stats.stats;
+
+        stats->frames_dropped += dropped;
+        if (ret == 0)
+        {
+            stats->frames_sent += 1;
+            stats->bytes_sent  += len;
+            hist_add(&stats->xfer, stop - start);
+            if (frame->finish_ns != 0)
+                hist_add(&stats->latency, stop - frame->finish_ns);
+        }
+        else
+            stats->xfer_errors += 1;
+    }
+    stats_end(&self->renderer_stats);
+
+    record_presented(self, frame, (ret == 0) ? APA102_FRAME_SENT : APA102_FRAME_FAILED, stop);
+
+    return ret;
+}
+
+
+static int get_canvas_size(apa102_t *self)
+{
+    return self->config->pixel_count * CANVAS_LANES * sizeof(uint16_t);
+}
+
+
+static void dither_encode(apa102_t *self, uint8_t *frame, uint8_t brightness)
+{
+    if (self->hdr != NULL)
+        blend_hdr_dither(frame + FRAME_DATA_POS, self->dither_src, self->dither_err, self->config->pixel_count, brightness, self->hdr);
+    else
+        blend16_dither(frame + FRAME_DATA_POS, self->dither_src, self->dither_err, self->config->pixel_count, brightness);
+
+    self->dither_ns = get_ns();
+}
+
+
+/*
+ * The canvas snapshot is kept, so the frame might go back to the pool.
+ * Dithering touches every pixel, so no prefix sending.
+ */
+static void dither_new_frame(apa102_t *self, apa102_frame_t *frame)
+{
+    memcpy(self->dither_src, frame->canvas, get_canvas_size(self));
+    self->dither_frame.brightness = frame->brightness;
+    dither_encode(self, frame->data, frame->brightness);
+    frame->dirty = self->config->pixel_count - 1;
+}
+
+
+/*
+ * Cleared by apa102_done() while the renderer and the presentation waiters
+ * run on other threads.
+ */
+static bool is_running(apa102_t *self)
+{
+    return __atomic_load_n(&self->is_renderer_running, __ATOMIC_ACQUIRE);
+}
+
+
+/*
+ * While there is no new frame, the last one is re-dithered and sent again at
+ * dither_hz, the accumulated errors are shown this way. New frame waits at
+ * most one period.
+ */
+static int renderer_get(apa102_t *self, void **item)
+{
+    uint64_t period;
+
+    if ((self->dither_src == NULL) || (self->config->dither_hz <= 0))
+        return queue_get(&self->full_frames, item, is_running(self));
+
+    period = 1000000000ULL / self->config->dither_hz;
+    while (queue_get(&self->full_frames, item, false) != 0)
+    {
+        uint64_t        next = self->dither_ns + period;
+        struct timespec ts   = {.tv_sec = next / 1000000000ULL, .tv_nsec = next % 1000000000ULL};
+
+        clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &ts, NULL);
+        if (queue_get(&self->full_frames, item, false) == 0)
+            break;
+
+        /* Nothing received yet, nothing to repeat */
+        if (self->dither_ns == 0)
+        {
+            self->dither_ns = get_ns();
+            continue;
+        }
+
+        dither_encode(self, self->dither_frame.data, self->dither_frame.brightness);
+        if (send_frame(self, &self->dither_frame, 0) == 0)
+        {
+            stats_begin(&self->renderer_stats);
+            self->renderer_stats.stats.frames_repeated += 1;
+            stats_end(&self->renderer_stats);
+        }
+    }
+
+    return 0;
+}
+
+
+static int get_frame_count(const apa102_config_t *config)
+{
+    int count = (config->frame_count > 0) ? config->frame_count : FRAME_COUNT_DEF;
+    int min   = (config->present_mode == APA102_PRESENT_MAILBOX) ? FRAME_COUNT_MBX : FRAME_COUNT_MIN;
+
+    /* Direct mode: one being rendered, the other one is the previous frame */
+    if (config->present_mode == APA102_PRESENT_DIRECT)
+        return FRAME_COUNT_MIN;
+
+    return (count >= min) ? count : min;
+}
+
+
+static void *renderer(void *arg)
+{
+    apa102_t *self    = (apa102_t *)arg;
+    bool      is_last = false;
+
+    while (!is_last)
+    {
+        void *item    = NULL;
+        void *next    = NULL;
+        int   dropped = 0;
+
+        if (   (renderer_get(self, &item) != 0)
+            || (item == NULL))
+            break;
+
+        /* Latest frame wins, the stale ones go back unsent */
+        while (   (self->config->present_mode == APA102_PRESENT_MAILBOX)
+               && (queue_get(&self->full_frames, &next, false) == 0))
+        {
+            if (next == NULL)
+            {
+                is_last = true;
+                break;
+            }
+
+            drop_frame(self, (apa102_frame_t *)item);
+            release_frame(self, (apa102_frame_t *)item);
+            item = next;
+            ++dropped;
+        }
+
+        if (self->dither_src != NULL)
+            dither_new_frame(self, (apa102_frame_t *)item);
+
+        if (self->config->on_transfer != NULL)
+            self->config->on_transfer(self->config->transfer_arg);
+
+        send_frame(self, (apa102_frame_t *)item, dropped);
+        release_frame(self, (apa102_frame_t *)item);
+    }
+
+    return NULL;
+}
+
+
+static int get_sched_policy(apa102_sched_t policy)
+{
+    switch (policy)
+    {
+        case APA102_SCHED_FIFO: return SCHED_FIFO;
+        case APA102_SCHED_RR:   return SCHED_RR;
+        default:                return SCHED_OTHER;
+    }
+}
+
+
+static void get_rt_param(const apa102_config_t *config, int *policy, struct sched_param *param, cpu_set_t *cpus)
+{
+    int min;
+    int max;
+    int i;
+
+    *policy = get_sched_policy(config->sched_policy);
+    min     = sched_get_priority_min(*policy);
+    max     = sched_get_priority_max(*policy);
+    memset(param, 0, sizeof(*param));
+    param->sched_priority = (config->sched_priority < min) ? min : ((config->sched_priority > max) ? max : config->sched_priority);
+
+    CPU_ZERO(cpus);
+    for (i = 0; i < 32; ++i)
+    {
+        if (config->cpu_mask & (1u << i))
+            CPU_SET(i, cpus);
+    }
+}
+
+
+static int get_rt_wanted(const apa102_config_t *config)
+{
+    return ((config->sched_policy != APA102_SCHED_DEFAULT) ? RT_SCHED    : 0)
+         | ((config->cpu_mask != 0)                        ? RT_AFFINITY : 0);
+}
+
+
+/*
+ * The renderer starts with its scheduling and affinity, so even its first
+ * frames are sent real-time. The attributes not permitted are left out one
+ * by one (all of them, the scheduling alone, the affinity alone, none).
+ */
+static int create_renderer(apa102_t *self)
+{
+    const apa102_config_t *config = self->config;
+    int                    wanted = get_rt_wanted(config);
+    struct sched_param     param;
+    cpu_set_t              cpus;
+    int                    policy;
+    int                    tried;
+
+    get_rt_param(config, &policy, &param, &cpus);
+
+    for (tried = wanted; ; tried = (tried - 1) & wanted)
+    {
+        pthread_attr_t attr;
+        int            ret;
+
+        pthread_attr_init(&attr);
+        if (tried & RT_SCHED)
+        {
+            pthread_attr_setinheritsched(&attr, PTHREAD_EXPLICIT_SCHED);
+            pthread_attr_setschedpolicy(&attr, policy);
+            pthread_attr_setschedparam(&attr, &param);
+        }
+        if (tried & RT_AFFINITY)
+            pthread_attr_setaffinity_np(&attr, sizeof(cpus), &cpus);
+
+        ret = pthread_create(&self->th_renderer, &attr, renderer, (void *)self);
+        pthread_attr_destroy(&attr);
+
+        if (ret == 0)
+        {
+            if ((wanted & ~tried & RT_SCHED) != 0)
+                DEBUG_MSG(stderr, "Cannot set the renderer scheduling, left default!\n");
+            if ((wanted & ~tried & RT_AFFINITY) != 0)
+                DEBUG_MSG(stderr, "Cannot set the renderer affinity, left default!\n");
+            return 0;
+        }
+
+        if (tried == 0)
+            break;
+    }
+
+    DEBUG_MSG(stderr, "Cannot create the renderer!\n");
+
+    return -1;
+}
+
+
+/*
+ * Direct mode has no renderer, the caller's thread is the one sending. Its
+ * scheduling and affinity are changed only when asked by is_rt_caller.
+ */
+static void setup_caller_rt(apa102_t *self)
+{
+    const apa102_config_t *config = self->config;
+    int                    wanted = get_rt_wanted(config);
+    struct sched_param     param;
+    cpu_set_t              cpus;
+    int                    policy;
+
+    get_rt_param(config, &policy, &param, &cpus);
+
+    if (   (wanted & RT_SCHED)
+        && (pthread_setschedparam(pthread_self(), policy, &param) != 0))
+        DEBUG_MSG(stderr, "Cannot set the caller's scheduling, left default!\n");
+
+    if (   (wanted & RT_AFFINITY)
+        && (pthread_setaffinity_np(pthread_self(), sizeof(cpus), &cpus) != 0))
+        DEBUG_MSG(stderr, "Cannot set the caller's affinity, left default!\n");
+}
+
+
+/*
+ * What the sending thread really got is read back to self->rt, the process
+ * memory is locked here (process wide anyway).
+ */
+static void setup_rt(apa102_t *self)
+{
+    const apa102_config_t *config = self->config;
+    struct sched_param     param  = {0};
+    pthread_t              thread = (config->present_mode == APA102_PRESENT_DIRECT) ? pthread_self() : self->th_renderer;
+    cpu_set_t              cpus;
+    int                    policy;
+    int                    i;
+
+    memset(&self->rt, 0, sizeof(self->rt));
+
+    if (config->is_mlockall)
+    {
+        self->rt.is_mlockall = (mlockall(MCL_CURRENT | MCL_FUTURE) == 0);
+        if (!self->rt.is_mlockall)
+            DEBUG_MSG(stderr, "Cannot lock the process memory!\n");
+    }
+
+    if ((config->present_mode == APA102_PRESENT_DIRECT) && config->is_rt_caller)
+        setup_caller_rt(self);
+
+    if (pthread_getschedparam(thread, &policy, &param) == 0)
+    {
+        self->rt.sched_policy   = (policy == SCHED_FIFO) ? APA102_SCHED_FIFO : ((policy == SCHED_RR) ? APA102_SCHED_RR : APA102_SCHED_DEFAULT);
+        self->rt.sched_priority = param.sched_priority;
+    }
+
+    if (pthread_getaffinity_np(thread, sizeof(cpus), &cpus) == 0)
+    {
+        for (i = 0; i < 32; ++i)
+        {
+            if (CPU_ISSET(i, &cpus))
+                self->rt.cpu_mask |= 1u << i;
+        }
+    }
+}
+
+
+/*****************************************************************************
+ * Public functions
+ ****************************************************************************/
+
+
+/*************************************************************************//**
+ * Initialize the context
+ *
+ * Some of the context members are supposed to be setup prior this call, the
+ * private part is initialized by this.
+ *
+ * All the state lives in the context (including the SPI one), so several
+ * chains might be driven by one process, each of them is rendered by its own
+ * thread, so the chains are refreshed in parallel. APA102_PRESENT_DIRECT has
+ * no renderer thread, the frames are sent by apa102_finish_frame() (dither_hz
+ * repeating does not apply then, the renderer settings apply to the caller).
+ *
+ * @param[in,out]    self      APA102 chain context
+ * @param[in]        config    Chain configuration (must outlive the context)
+ *
+ * @return    zero on success, nonzero otherwise
+ *
+ ****************************************************************************/
+int apa102_init(apa102_t *self, const apa102_config_t *config)
+{
+    bool is_lockfree;
+    int  ret;
+    int  i;
+
+    DEBUG_FMT(stderr, "Initializing: %s, %d Hz, %d pix, brightness %d\n", config->spi_device, config->spi_speed, config->pixel_count, config->brightness);
+
+    DEBUG_MSG(stderr, "Opening SPI...\n");
+    ret = apa102spi_open(&self->spi, config->backend, config->spi_device, config->spi_speed);
+    if (ret != 0)
+        return ret;
+
+    self->config       = config;
+    self->frame_count  = get_frame_count(config);
+    self->brightness   = config->brightness & BRIGHT_MASK;
+    self->prev_brightness = self->brightness;
+    self->active       = NULL;
+    self->active_frame = NULL;
+    self->prev_frame   = NULL;
+    self->last_sent_ns  = 0;
+    self->last_start_ns = 0;
+    self->pending_dirty = -1;
+    self->hdr           = NULL;
+    self->dither_ns     = 0;
+
+    if (create_arena(self) != 0)
+    {
+        apa102spi_close(&self->spi);
+        return -1;
+    }
+
+    if (config->encode == APA102_ENCODE_HDR)
+    {
+        self->hdr = (blend_hdr_t *)malloc(sizeof(blend_hdr_t));
+        blend_hdr_init(self->hdr, config->gamma);
+    }
+
+    /* Frames carry the canvas to the renderer, which encodes them */
+    if (config->is_dither)
+    {
+        self->dither_frame.canvas     = NULL;
+        self->dither_frame.finish_ns  = 0;
+        self->dither_frame.dirty      = config->pixel_count - 1;
+        self->dither_frame.brightness = self->brightness;
+        self->dither_frame.id         = 0;
+        init_frame(self, self->dither_frame.data);
+    }
+
+    memset(&self->producer_stats, 0, sizeof(apa102_counters_t));
+    memset(&self->renderer_stats, 0, sizeof(apa102_counters_t));
+
+    /* Waiting for the presentation with timeout measured as the frames are */
+    {
+        pthread_condattr_t attr;
+
+        pthread_condattr_init(&attr);
+        pthread_condattr_setclock(&attr, CLOCK_MONOTONIC);
+        pthread_cond_init(&self->presented_cv, &attr);
+        pthread_condattr_destroy(&attr);
+    }
+    pthread_mutex_init(&self->presented_mx, NULL);
+    memset(self->presented, 0, sizeof(self->presented));
+    self->frame_id     = 0;
+    self->presented_id = 0;
+
+    /* Event loop integration, left out if not available */
+    self->free_fd      = -1;
+    self->presented_fd = -1;
+    if (config->is_eventfd)
+    {
+        self->free_fd      = eventfd(self->frame_count, EFD_NONBLOCK | EFD_CLOEXEC);
+        self->presented_fd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+        DEBUG_FMT(stderr, "Eventfds: free %d, presented %d\n", self->free_fd, self->presented_fd);
+    }
+
+    DEBUG_MSG(stderr, "Preparing FIFOs...\n");
+    is_lockfree = (config->queue == APA102_QUEUE_LOCKFREE);
+    queue_init(&self->free_frames, is_lockfree, self->frame_count, "free_frames");
+    queue_init(&self->full_frames, is_lockfree, self->frame_count, "full_frames");
+
+    for (i = 0; i < self->frame_count; ++i)
+    {
+        queue_put(&self->free_frames, (void *)(&self->frame_pool[i]), false);
+    }
+
+    /* Direct mode sends from the producer's thread, nothing to create */
+    __atomic_store_n(&self->is_renderer_running, true, __ATOMIC_RELEASE);
+    if (config->present_mode != APA102_PRESENT_DIRECT)
+    {
+        DEBUG_MSG(stderr, "Creating renderer...\n");
+        if (create_renderer(self) != 0)
         {
-            frame[pos + 0] = raw;
-            pos += PIXEL_LEN;
+            __atomic_store_n(&self->is_renderer_running, false, __ATOMIC_RELEASE);
+            queue_done(&self->full_frames);
+            queue_done(&self->free_frames);
+            if (self->free_fd >= 0)
+                close(self->free_fd);
+            if (self->presented_fd >= 0)
+                close(self->presented_fd);
+            self->free_fd      = -1;
+            self->presented_fd = -1;
+            pthread_cond_destroy(&self->presented_cv);
+            pthread_mutex_destroy(&self->presented_mx);
+            free(self->hdr);
+            self->hdr = NULL;
+            delete_arena(self);
+            apa102spi_close(&self->spi);
+            return -1;
         }
     }
+    setup_rt(self);
+
+    DEBUG_FMT(stderr, "Renderer: policy %d, priority %d, CPUs 0x%x, mlockall %d\n", self->rt.sched_policy, self->rt.sched_priority, self->rt.cpu_mask, self->rt.is_mlockall);
+
+    return 0;
+}
+
+
+/*************************************************************************//**
+ * Finalize the context
+ *
+ * Also release any allocated resources.
+ *
+ * @param[in,out]    self    APA102 chain context
+ *
+ * @return    zero on success, nonzero otherwise
+ *
+ ****************************************************************************/
+int apa102_done(apa102_t *self)
+{
+    int ret = -1;
+
+    DEBUG_MSG(stderr, "Finalizing...\n");
+
+    __atomic_store_n(&self->is_renderer_running, false, __ATOMIC_RELEASE);
+
+    if (self->config->present_mode != APA102_PRESENT_DIRECT)
+    {
+        queue_put(&self->full_frames, NULL, true);
+        pthread_join(self->th_renderer, NULL);
+    }
+
+    /* Nothing more is going to be presented */
+    pthread_mutex_lock(&self->presented_mx);
+    pthread_cond_broadcast(&self->presented_cv);
+    pthread_mutex_unlock(&self->presented_mx);
+    pthread_cond_destroy(&self->presented_cv);
+    pthread_mutex_destroy(&self->presented_mx);
+
+    if (self->free_fd >= 0)
+        close(self->free_fd);
+    if (self->presented_fd >= 0)
+        close(self->presented_fd);
+    self->free_fd      = -1;
+    self->presented_fd = -1;
+
+    ret = apa102spi_close(&self->spi);
+
+    queue_done(&self->full_frames);
+    queue_done(&self->free_frames);
+
+    delete_arena(self);
+
+    free(self->hdr);
+    self->hdr = NULL;
+
+    return ret;
+}
+
+
+/*************************************************************************//**
+ * Prepare for rendering of the new frame
+ *
+ * Any pixel manipulation is supposed to be done between begin/finish frame
+ * calls.
+ *
+ * @param[in,out]    self         APA102 chain context
+ * @param[in]        copy_last    Copy the previous frame content or start with
+ *                                empty one
+ *
+ * @return    zero on success, nonzero otherwise
+ *
+ ****************************************************************************/
+int apa102_begin_frame(apa102_t *self, bool copy_last)
+{
+    return apa102_try_begin_frame(self, copy_last, -1);
+}
+
+
+/*************************************************************************//**
+ * Prepare for rendering of the new frame, wait limited time
+ *
+ * As apa102_begin_frame(), but gives up when no frame gets free in time
+ * (nothing is begun then). Meant for event loops, with is_eventfd the
+ * apa102_get_free_fd() one becomes readable when it is worth trying again.
+ *
+ * @param[in,out]    self          APA102 chain context
+ * @param[in]        copy_last     Copy the previous frame content or start
+ *                                 with empty one
+ * @param[in]        timeout_ms    Wait at most this long (0: just try,
+ *                                 <0: forever)
+ *
+ * @return    zero on success, -1 when no frame is free (timeout)
+ *
+ ****************************************************************************/
+int apa102_try_begin_frame(apa102_t *self, bool copy_last, int timeout_ms)
+{
+    void    *item       = NULL;
+    uint8_t *prev_frame = self->prev_frame;
+    uint8_t *curr_frame;
+
+    DEBUG_MSG(stderr, "Starting new frame...\n");
+
+    /* Time is measured only if there is really some waiting */
+    if (queue_get(&self->free_frames, &item, false) != 0)
+    {
+        uint64_t start = get_ns();
+
+        if ((timeout_ms == 0) || (queue_get_timed(&self->free_frames, &item, timeout_ms) != 0))
+            return -1;
+
+        stats_begin(&self->producer_stats);
+        hist_add(&self->producer_stats.stats.blocked, get_ns() - start);
+        stats_end(&self->producer_stats);
+    }
+
+    /*
+     * Free frames' eventfd is kept readable while any frame is free. Reset
+     * when the last one is taken, then re-check, a frame released in
+     * between signals again.
+     */
+    if ((self->free_fd >= 0) && (queue_count(&self->free_frames) == 0))
+    {
+        uint64_t count;
+
+        if (   (read(self->free_fd, &count, sizeof(count)) == sizeof(count))
+            && (queue_count(&self->free_frames) > 0))
+            signal_fd(self->free_fd, 1);
+    }
+
+    curr_frame = ((apa102_frame_t *)item)->data;
+
+    /* Unless continuing the previous frame, whole chain is considered changed */
+    if (self->canvas != NULL)
+    {
+        /* Canvas keeps the previous content, frame data are encoded at finish */
+        if (copy_last && (prev_frame != NULL))
+        {
+            ((apa102_frame_t *)item)->dirty = -1;
+        }
+        else
+        {
+            memset(self->canvas, 0, self->config->pixel_count * CANVAS_LANES * sizeof(uint16_t));
+            ((apa102_frame_t *)item)->dirty = self->config->pixel_count - 1;
+        }
+    }
+    else if (copy_last && (prev_frame != NULL))
+    {
+        memcpy(curr_frame, (void *)prev_frame, self->frame_len);
+        ((apa102_frame_t *)item)->dirty = -1;
+    }
+    else
+    {
+        init_frame(self, curr_frame);
+        ((apa102_frame_t *)item)->dirty = self->config->pixel_count - 1;
+    }
+
+    self->active       = (apa102_frame_t *)item;
+    self->active_frame = curr_frame;
+
+    return 0;
+}
+
+
+/*************************************************************************//**
+ * Finish rendering of the frame
+ *
+ * Finished frame is requested to be renderred (means to be sent over SPI to
+ * LEDs). In the mailbox mode, the frame might be superseded by a newer one
+ * before the renderer gets to it, then it is not sent at all. In the direct
+ * mode, it is sent before returning.
+ *
+ * @param[in,out]    self    APA102 chain context
+ *
+ * @return    zero on success, nonzero otherwise
+ *
+ ****************************************************************************/
+int apa102_finish_frame(apa102_t *self)
+{
+    return apa102_finish_frame_id(self, NULL);
+}
+
+
+/*************************************************************************//**
+ * Finish rendering of the frame, get its sequence number
+ *
+ * As apa102_finish_frame(), the frames are numbered from 1 in the order they
+ * are finished. The number might be passed to apa102_wait_presented() or
+ * matched in the apa102_config_t.on_presented callback.
+ *
+ * @param[in,out]    self    APA102 chain context
+ * @param[out]       id      Frame sequence number (NULL: not needed)
+ *
+ * @return    zero on success, nonzero otherwise
+ *
+ ****************************************************************************/
+int apa102_finish_frame_id(apa102_t *self, uint64_t *id)
+{
+    apa102_frame_t *curr = self->active;
+
+    curr->id = __atomic_add_fetch(&self->frame_id, 1, __ATOMIC_RELAXED);
+    if (id != NULL)
+        *id = curr->id;
+
+    /* Global brightness applies to the whole frame, changed one to all pixels */
+    curr->brightness = self->brightness;
+    if (self->brightness != self->prev_brightness)
+    {
+        curr->dirty           = self->config->pixel_count - 1;
+        self->prev_brightness = self->brightness;
+    }
+
+    if (self->dither_src != NULL)
+        memcpy(curr->canvas, self->canvas, get_canvas_size(self));
+    else if (self->hdr != NULL)
+        blend_hdr_encode(self->active_frame + FRAME_DATA_POS, self->canvas, self->config->pixel_count, curr->brightness, self->hdr);
+    else if (self->canvas != NULL)
+        blend16_encode(self->active_frame + FRAME_DATA_POS, self->canvas, self->config->pixel_count, curr->brightness);
+
+    self->prev_frame   = self->active_frame;
+    self->active       = NULL;
+    self->active_frame = NULL;
+
+    stats_begin(&self->producer_stats);
+    self->producer_stats.stats.frames_submitted += 1;
+    stats_end(&self->producer_stats);
+
+    curr->finish_ns = get_ns();
+
+    /* Rendered and sent inline, the frame is free again at once */
+    if (self->config->present_mode == APA102_PRESENT_DIRECT)
+    {
+        int ret;
+
+        if (self->dither_src != NULL)
+            dither_new_frame(self, curr);
+
+        ret = send_frame(self, curr, 0);
+        release_frame(self, curr);
+
+        return ret;
+    }
+
+    return queue_put(&self->full_frames, (void *)curr, true);
+}
+
+
+/*************************************************************************//**
+ * Wait until the frame is resolved by the renderer
+ *
+ * Sent frame tells when its transfer was done, so the producer might measure
+ * the finish to LEDs latency and compensate for it (e.g. A/V alignment).
+ * Frame skipped as identical to the shown one counts as presented when the
+ * renderer got to it. Only the last APA102_PRESENT_HISTORY frames are known.
+ *
+ * @param[in,out]    self          APA102 chain context
+ * @param[in]        id            Frame sequence number (apa102_finish_frame_id())
+ * @param[in]        timeout_ms    Wait at most this long (0: just check, <0: forever)
+ * @param[out]       presented     Presentation feedback
+ *
+ * @return    zero on success, -1 on timeout, -2 for unknown frame (not
+ *            finished yet, too old or the renderer stopped)
+ *
+ ****************************************************************************/
+int apa102_wait_presented(apa102_t *self, uint64_t id, int timeout_ms, apa102_presented_t *presented)
+{
+    struct timespec ts;
+    int             ret = 0;
+
+    if ((id == 0) || (id > __atomic_load_n(&self->frame_id, __ATOMIC_RELAXED)))
+        return -2;
+
+    if (timeout_ms > 0)
+    {
+        uint64_t until = get_ns() + timeout_ms * 1000000ULL;
+
+        ts.tv_sec  = until / 1000000000ULL;
+        ts.tv_nsec = until % 1000000000ULL;
+    }
+
+    pthread_mutex_lock(&self->presented_mx);
+    while ((self->presented_id < id) && (ret == 0))
+    {
+        bool is_alive = is_running(self);
+
+        if (!is_alive || (timeout_ms == 0))
+            ret = is_alive ? -1 : -2;
+        else if (timeout_ms < 0)
+            pthread_cond_wait(&self->presented_cv, &self->presented_mx);
+        else if (pthread_cond_timedwait(&self->presented_cv, &self->presented_mx, &ts) != 0)
+            ret = -1;
+    }
+
+    if (ret == 0)
+    {
+        *presented = self->presented[id % APA102_PRESENT_HISTORY];
+        if (presented->id != id)
+            ret = -2;
+    }
+    pthread_mutex_unlock(&self->presented_mx);
+
+    return ret;
+}
+
+
+/*************************************************************************//**
+ * Change pixel color
+ *
+ * Use the AARRGGBB format for the pixel color, where for AA value above 0x1f is
+ * considered to be invalid and the pixel follows the global brightness.
+ *
+ * @param[in,out]    self     APA102 chain context
+ * @param[in]        pixel    LED offset in the chain
+ * @param[in]        argb     Desired color
+ * @param[in]        mode     Pixel combination mode (might need some additional
+ *                            love to be more useful)
+ *
+ * @return    zero on success, nonzero otherwise (pixel out of range)
+ *
+ ****************************************************************************/
+int apa102_set_pixel(apa102_t *self, int pixel, uint32_t argb, apa102_pix_mode_t mode)
+{
+    uint8_t *frame = self->active_frame;
+    int      pos   = get_pixel_pos(self, pixel);
+
+    if (frame == NULL)
+    {
+        DEBUG_MSG(stderr, "Frame not started!\n");
+        return -1;
+    }
+
+    if (pos < 0)
+    {
+        DEBUG_FMT(stderr, "Ignoring request to pixel %d, value 0x%08x!\n", pixel, argb);
+        return -2;
+    }
+
+    if (pixel > self->active->dirty)
+        self->active->dirty = pixel;
+
+    DEBUG_FMT(stdout, "Setting pixel %3d, value 0x%02x_%02x_%02x_%02x, pos %d\n", pixel, (argb >> 24) & 0xff, (argb >> 16) & 0xff, (argb >> 8) & 0xff, (argb >> 0) & 0xff, pos);
+    if (self->canvas != NULL)
+        blend16_pixel(self->canvas + pixel * CANVAS_LANES, COL_TO16(argb), mode, self->brightness);
+    else
+        blend_pixel(frame + pos, argb, mode, self->brightness);
+
+    return 0;
+}
+
+
+/*************************************************************************//**
+ * Change pixel color with 16 bits per channel
+ *
+ * Use COL_ARGB16() for the color, alpha has the same meaning as for
+ * apa102_set_pixel(). Without the canvas (apa102_config_t.is_canvas) the
+ * channels are just cut to 8 bits.
+ *
+ * @param[in,out]    self      APA102 chain context
+ * @param[in]        pixel     LED offset in the chain
+ * @param[in]        argb16    Desired color
+ * @param[in]        mode      Pixel combination mode
+ *
+ * @return    zero on success, nonzero otherwise (pixel out of range)
+ *
+ ****************************************************************************/
+int apa102_set_pixel16(apa102_t *self, int pixel, uint64_t argb16, apa102_pix_mode_t mode)
+{
+    if (self->canvas == NULL)
+        return apa102_set_pixel(self, pixel, COL_ARGB(COL16_ALP(argb16), COL16_RED(argb16) >> 8, COL16_GRN(argb16) >> 8, COL16_BLU(argb16) >> 8), mode);
+
+    if (self->active_frame == NULL)
+    {
+        DEBUG_MSG(stderr, "Frame not started!\n");
+        return -1;
+    }
+
+    if (get_pixel_pos(self, pixel) < 0)
+    {
+        DEBUG_FMT(stderr, "Ignoring request to pixel %d!\n", pixel);
+        return -2;
+    }
+
+    if (pixel > self->active->dirty)
+        self->active->dirty = pixel;
+
+    blend16_pixel(self->canvas + pixel * CANVAS_LANES, argb16, mode, self->brightness);
+
+    return 0;
+}
+
+
+/*************************************************************************//**
+ * Change color of a run of consecutive pixels
+ *
+ * Same as apa102_set_pixel() called for pixels first .. first + count - 1,
+ * but the checks and the mode dispatch are done once for the whole run. The
+ * part of the run outside of the chain is ignored.
+ *
+ * @param[in,out]    self     APA102 chain context
+ * @param[in]        first    LED offset of the first pixel in the chain
+ * @param[in]        count    Number of pixels
+ * @param[in]        argb     Desired colors, count items
+ * @param[in]        mode     Pixel combination mode
+ *
+ * @return    zero on success, nonzero otherwise (run (partially) out of range)
+ *
+ ****************************************************************************/
+int apa102_set_span(apa102_t *self, int first, int count, const uint32_t *argb, apa102_pix_mode_t mode)
+{
+    uint8_t *frame = self->active_frame;
+    int      ret   = 0;
+
+    if (frame == NULL)
+    {
+        DEBUG_MSG(stderr, "Frame not started!\n");
+        return -1;
+    }
+
+    if (first < 0)
+    {
+        argb  -= first;
+        count += first;
+        first  = 0;
+        ret    = -2;
+    }
+
+    if (count > self->config->pixel_count - first)
+    {
+        count = self->config->pixel_count - first;
+        ret   = -2;
+    }
+
+    if (count <= 0)
+    {
+        DEBUG_FMT(stderr, "Ignoring request to span %d+%d!\n", first, count);
+        return -2;
+    }
+
+    if (first + count - 1 > self->active->dirty)
+        self->active->dirty = first + count - 1;
+
+    if (self->canvas != NULL)
+        blend16_span(self->canvas + first * CANVAS_LANES, argb, count, mode, self->brightness);
+    else
+        blend_span(frame + get_pixel_pos(self, first), argb, count, mode, self->brightness);
+
+    return ret;
+}
+
+
+/*************************************************************************//**
+ * Change color of a batch of arbitrary pixels
+ *
+ * Same as apa102_set_pixel() called for each (pixel[i], argb[i]) pair, but
+ * with a single call and mode dispatch. Pixels out of range are ignored.
+ *
+ * @param[in,out]    self     APA102 chain context
+ * @param[in]        pixel    LED offsets in the chain, count items
+ * @param[in]        argb     Desired colors, count items
+ * @param[in]        count    Number of pixels
+ * @param[in]        mode     Pixel combination mode
+ *
+ * @return    zero on success, nonzero otherwise (some pixel out of range)
+ *
+ ****************************************************************************/
+int apa102_set_pixels(apa102_t *self, const int *pixel, const uint32_t *argb, int count, apa102_pix_mode_t mode)
+{
+    uint8_t *frame = self->active_frame;
+    int      ignored;
+
+    if (frame == NULL)
+    {
+        DEBUG_MSG(stderr, "Frame not started!\n");
+        return -1;
+    }
+
+    if (self->canvas != NULL)
+        ignored = blend16_scatter(self->canvas, self->config->pixel_count, pixel, argb, count, mode, self->brightness, &self->active->dirty);
+    else
+        ignored = blend_scatter(frame + FRAME_DATA_POS, self->config->pixel_count, pixel, argb, count, mode, self->brightness, &self->active->dirty);
+    if (ignored != 0)
+    {
+        DEBUG_FMT(stderr, "Ignored %d pixels out of range!\n", ignored);
+        return -2;
+    }
+
+    return 0;
+}
+
+
+/*************************************************************************//**
+ * Get the view of the frame being rendered
+ *
+ * For the inlined setters of apa102_inline.h. Those might write any pixel, so
+ * the whole chain is considered changed. Not available with the canvas.
+ *
+ * @param[in,out]    self    APA102 chain context
+ * @param[out]       view    Frame view, valid until apa102_finish_frame()
+ *
+ * @return    zero on success, nonzero otherwise
+ *
+ ****************************************************************************/
+int apa102_get_view(apa102_t *self, apa102_view_t *view)
+{
+    if (self->active_frame == NULL)
+    {
+        DEBUG_MSG(stderr, "Frame not started!\n");
+        return -1;
+    }
+
+    if (self->canvas != NULL)
+    {
+        DEBUG_MSG(stderr, "No view of the canvas!\n");
+        return -2;
+    }
+
+    view->pixels        = self->active_frame + FRAME_DATA_POS;
+    view->count         = self->config->pixel_count;
+    view->brightness    = self->brightness;
+    self->active->dirty = self->config->pixel_count - 1;
+
+    return 0;
+}
+
+
+/*************************************************************************//**
+ * Get the current pixel color
+ *
+ * Alpha is the pixel's own brightness, 0xff for the ones following the
+ * global brightness.
+ *
+ * @param[in,out]    self     APA102 chain context
+ * @param[in]        pixel    LED offset in the chain
+ * @param[out]       argb     Read color
+ *
+ * @return    zero on success, nonzero otherwise (pixel out of range)
+ *
+ ****************************************************************************/
+int apa102_get_pixel(apa102_t *self, int pixel, uint32_t *argb)
+{
+    uint8_t *frame = self->active_frame;
+    int      pos   = get_pixel_pos(self, pixel);
+    int      ret   = 0;
+
+    if ((pos >= 0) && (self->canvas != NULL))
+    {
+        uint16_t *pix    = self->canvas + pixel * CANVAS_LANES;
+        uint8_t   bright = (pix[0] <= BRIGHT_MAX) ? pix[0] : 0xff;
+
+        *argb = COL_ARGB(bright, pix[3] >> 8, pix[2] >> 8, pix[1] >> 8);
+    }
+    else if (pos >= 0)
+    {
+        uint8_t bright = BRIGHT_IS_OWN(frame[pos + 0]) ? (BRIGHT_MASK & frame[pos + 0]) : 0xff;
+
+        *argb = COL_ARGB(bright, frame[pos + 3], frame[pos + 2], frame[pos + 1]);
+    }
+    else
+        ret = -1;
+
+    return ret;
+}
+
+
+/*************************************************************************//**
+ * Change brightness of one pixel only
+ *
+ * The pixel keeps its color, the brightness above 31 makes it follow the
+ * global one (apa102_set_brightness()) again.
+ *
+ * @param[in,out]    self          APA102 chain context
+ * @param[in]        pixel         LED offset in the chain
+ * @param[in]        brightness    Desired brightness level 0-31
+ *
+ * @return    zero on success, nonzero otherwise (pixel out of range)
+ *
+ ****************************************************************************/
+int apa102_set_pixel_brightness(apa102_t *self, int pixel, uint8_t brightness)
+{
+    uint8_t *frame = self->active_frame;
+    int      pos   = get_pixel_pos(self, pixel);
+
+    if (frame == NULL)
+    {
+        DEBUG_MSG(stderr, "Frame not started!\n");
+        return -1;
+    }
+
+    if (pos < 0)
+    {
+        DEBUG_FMT(stderr, "Ignoring brightness of pixel %d!\n", pixel);
+        return -2;
+    }
+
+    if (pixel > self->active->dirty)
+        self->active->dirty = pixel;
+
+    if (self->canvas != NULL)
+        self->canvas[pixel * CANVAS_LANES] = (brightness <= BRIGHT_MAX) ? brightness : CANVAS_DEF;
+    else
+        frame[pos + 0] = blend_bright(brightness);
+
+    return 0;
+}
+
+
+/*************************************************************************//**
+ * Switch off all LEDs in the chain
+ *
+ * @param[in,out]    self    APA102 chain context
+ *
+ ****************************************************************************/
+void apa102_clear(apa102_t *self)
+{
+    if (self->canvas != NULL)
+        blend16_fill(self->canvas, COL_ARGB16(0, 0, 0, 0), self->config->pixel_count, self->brightness);
+    else
+        blend_fill(self->active_frame + FRAME_DATA_POS, COL_ARGB(0, 0, 0, 0), self->config->pixel_count, self->brightness);
+
+    self->active->dirty = self->config->pixel_count - 1;
+}
+
+
+/*************************************************************************//**
+ * Change color of all LEDs in the chain
+ *
+ * @param[in,out]    self    APA102 chain context
+ * @param[in]        argb    Desired color
+ *
+ ****************************************************************************/
+void apa102_fill(apa102_t *self, uint32_t argb)
+{
+    if (self->active_frame == NULL)
+    {
+        DEBUG_MSG(stderr, "Frame not started!\n");
+        return;
+    }
+
+    if (self->canvas != NULL)
+        blend16_fill(self->canvas, COL_TO16(argb), self->config->pixel_count, self->brightness);
+    else
+        blend_fill(self->active_frame + FRAME_DATA_POS, argb, self->config->pixel_count, self->brightness);
+
+    self->active->dirty = self->config->pixel_count - 1;
+}
+
+
+/*************************************************************************//**
+ * Change brightness of all LEDs in the chain
+ *
+ * No pixel is touched, the value is applied to the pixels without their own
+ * brightness when the frame is encoded or sent. It is taken by the frame being
+ * finished next (the current one, if any) and all the following ones.
+ *
+ * @param[in,out]    self          APA102 chain context
+ * @param[in]        brightness    Desired brightness level 0-31
+ *
+ ****************************************************************************/
+void apa102_set_brightness(apa102_t *self, uint8_t brightness)
+{
+    if (brightness > BRIGHT_MAX)
+        brightness = BRIGHT_MAX;
+
+    self->brightness = brightness;
+}
+
+
+/*************************************************************************//**
+ * Get renderer statistics
+ *
+ * Might be called from any thread at any time, no locking is involved, the
+ * counters are cumulative since apa102_init().
+ *
+ * @param[in,out]    self     APA102 chain context
+ * @param[out]       stats    Statistics snapshot
+ *
+ ****************************************************************************/
+void apa102_get_stats(apa102_t *self, apa102_stats_t *stats)
+{
+    apa102_stats_t producer;
+
+    stats_read(&self->renderer_stats, stats);
+    stats_read(&self->producer_stats, &producer);
+
+    stats->frames_submitted = producer.frames_submitted;
+    stats->blocked          = producer.blocked;
+    stats->queue_depth      = queue_count(&self->full_frames);
+
+    hist_finish(&stats->xfer);
+    hist_finish(&stats->latency);
+    hist_finish(&stats->interval);
+    hist_finish(&stats->blocked);
+}
+
+
+/*************************************************************************//**
+ * Get the real-time settings the renderer got
+ *
+ * Requested by apa102_config_t, the ones not permitted (no CAP_SYS_NICE,
+ * RLIMIT_MEMLOCK too low, ...) are left out instead of failing the init.
+ * In direct mode these are the ones of the thread which called
+ * apa102_init(), changed only with is_rt_caller.
+ *
+ * @param[in,out]    self    APA102 chain context
+ * @param[out]       rt      Settings in effect
+ *
+ ****************************************************************************/
+void apa102_get_rt(apa102_t *self, apa102_rt_t *rt)
+{
+    *rt = self->rt;
+}
+
+
+/*************************************************************************//**
+ * Get the free frames' eventfd
+ *
+ * Readable while some frame is free, so apa102_try_begin_frame() succeeds
+ * (it resets the fd when taking the last free frame, do not read it).
+ *
+ * @param[in]    self    APA102 chain context
+ *
+ * @return    file descriptor, -1 when not enabled (is_eventfd)
+ *
+ ****************************************************************************/
+int apa102_get_free_fd(apa102_t *self)
+{
+    return self->free_fd;
+}
+
+
+/*************************************************************************//**
+ * Get the presented frames' eventfd
+ *
+ * Counts the frames resolved by the renderer (see apa102_wait_presented()),
+ * reading it returns the count since the last read and resets it.
+ *
+ * @param[in]    self    APA102 chain context
+ *
+ * @return    file descriptor, -1 when not enabled (is_eventfd)
+ *
+ ****************************************************************************/
+int apa102_get_presented_fd(apa102_t *self)
+{
+    return self->presented_fd;
 }
 
 
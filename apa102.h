@@ -7,10 +7,20 @@
 #ifndef __APA102_H__
 #define __APA102_H__
 
+#include <stddef.h>
 #include <stdint.h>
 #include <stdbool.h>
 #include <pthread.h>
 #include "sync_fifo.h"
+#include "spsc_fifo.h"
+#include "apa102spi.h"
+
+
+/*****************************************************************************
+ * Public macros
+ ****************************************************************************/
+#define APA102_HIST_BUCKETS 32
+#define APA102_PRESENT_HISTORY 64  /* frames apa102_wait_presented() might ask for */
 
 
 /*****************************************************************************
@@ -32,18 +42,206 @@ typedef enum apa102_pix_mode_tt
 } apa102_pix_mode_t;
 
 
+/**
+ * Frame queue implementation
+ */
+typedef enum apa102_queue_type_tt
+{
+    APA102_QUEUE_LOCKED,    /**< Mutex/condvar protected (sync_fifo)    */
+    APA102_QUEUE_LOCKFREE,  /**< Lock-free single producer/consumer ring */
+} apa102_queue_type_t;
+
+
+/**
+ * Presentation mode
+ */
+typedef enum apa102_present_mode_tt
+{
+    APA102_PRESENT_FIFO,     /**< Every finished frame is sent, in order       */
+    APA102_PRESENT_MAILBOX,  /**< Newest finished frame is sent, stale dropped */
+    APA102_PRESENT_DIRECT,   /**< Sent by apa102_finish_frame(), no renderer   */
+} apa102_present_mode_t;
+
+
+/**
+ * Canvas to wire encoding
+ */
+typedef enum apa102_encode_tt
+{
+    APA102_ENCODE_RAW,  /**< Channels cut to 8 bits, brightness as set       */
+    APA102_ENCODE_HDR,  /**< Gamma, global brightness picked per pixel (canvas) */
+} apa102_encode_t;
+
+
+/**
+ * Renderer thread scheduling policy
+ */
+typedef enum apa102_sched_tt
+{
+    APA102_SCHED_DEFAULT,  /**< Inherited from the process (SCHED_OTHER) */
+    APA102_SCHED_FIFO,     /**< SCHED_FIFO real-time                     */
+    APA102_SCHED_RR,       /**< SCHED_RR real-time                       */
+} apa102_sched_t;
+
+
+/**
+ * What happened to a finished frame
+ */
+typedef enum apa102_frame_status_tt
+{
+    APA102_FRAME_SENT,     /**< Transferred to the LEDs                       */
+    APA102_FRAME_SKIPPED,  /**< Not sent, the LEDs showed the same already    */
+    APA102_FRAME_DROPPED,  /**< Superseded before sent (mailbox), never shown */
+    APA102_FRAME_FAILED,   /**< Transfer failed                               */
+} apa102_frame_status_t;
+
+
+/**
+ * Presentation feedback of one frame
+ */
+typedef struct apa102_presented_tt
+{
+    uint64_t              id;          /**< Frame sequence number (from 1)            */
+    apa102_frame_status_t status;      /**< What happened to it                       */
+    uint64_t              present_ns;  /**< Transfer done / skip decided (monotonic)  */
+} apa102_presented_t;
+
+
+/**
+ * Presentation callback, called by the renderer thread (keep it short)
+ */
+typedef void (*apa102_presented_cb_t)(void *arg, const apa102_presented_t *presented);
+
+
+/**
+ * Renderer hook before a new frame's transfer (e.g. chains kept in lockstep)
+ */
+typedef void (*apa102_transfer_cb_t)(void *arg);
+
+
+struct blend_hdr_tt;
+
+
 /**
  * Configuration options
  */
 typedef struct apa102_config_tt
 {
-    const char *spi_device;   /**< SPI Device name */
-    int         spi_speed;    /**< SPI Speed in Hz */
-    int         pixel_count;  /**< Number of leds in the chain */
-    int         brightness;   /**< Default brightness (0:off - 31:max) */
+    const char                *spi_device;     /**< SPI Device name */
+    int                        spi_speed;      /**< SPI Speed in Hz */
+    int                        pixel_count;    /**< Number of leds in the chain */
+    int                        brightness;     /**< Default brightness (0:off - 31:max) */
+    const apa102spi_backend_t *backend;        /**< Output backend (NULL: SPIdev) */
+    apa102_queue_type_t        queue;          /**< Frame queue implementation */
+    apa102_present_mode_t      present_mode;   /**< Presentation mode */
+    int                        frame_count;    /**< Frames in the pool (0: default) */
+    bool                       is_skip_same;   /**< Do not send frames identical to the last sent one */
+    int                        keepalive_ms;   /**< Resend identical frame after this time (0: never) */
+    bool                       is_prefix;      /**< Send only the changed start of the chain */
+    bool                       is_canvas;      /**< Paint into 16 bit per channel canvas, encoded at finish */
+    apa102_encode_t            encode;         /**< Canvas encoding (HDR implies the canvas) */
+    double                     gamma;          /**< HDR encoding gamma (0: 2.2) */
+    bool                       is_dither;      /**< Temporal dithering by the renderer (implies the canvas) */
+    int                        dither_hz;      /**< Re-dither the last frame while idle at this rate (0: never) */
+    bool                       is_locked;      /**< mlock() the frame arena (left unlocked if not permitted) */
+    bool                       is_hugepages;   /**< Frame arena in hugepages (normal pages if not available) */
+    apa102_sched_t             sched_policy;   /**< Renderer scheduling policy */
+    int                        sched_priority; /**< Renderer priority for FIFO/RR (clamped to the policy range) */
+    uint32_t                   cpu_mask;       /**< Renderer CPU affinity, bit per CPU (0: any) */
+    bool                       is_mlockall;    /**< Lock all the process memory, current and future */
+    bool                       is_rt_caller;   /**< Direct mode: apply sched_policy/cpu_mask to the thread calling apa102_init() (untouched otherwise) */
+    apa102_presented_cb_t      on_presented;   /**< Presentation callback (NULL: none) */
+    void                      *presented_arg;  /**< Its argument */
+    bool                       is_eventfd;     /**< Signal free and presented frames via eventfds */
+    apa102_transfer_cb_t       on_transfer;    /**< Called before each new frame is sent (NULL: none) */
+    void                      *transfer_arg;   /**< Its argument */
 } apa102_config_t;
 
 
+/**
+ * Duration distribution
+ *
+ * Bucket i counts durations of [2^i, 2^(i+1)) microseconds, bucket 0 takes
+ * everything shorter as well.
+ */
+typedef struct apa102_histogram_tt
+{
+    uint64_t count;                         /**< Number of samples     */
+    uint64_t min_ns;                        /**< Shortest one          */
+    uint64_t max_ns;                        /**< Longest one           */
+    uint64_t avg_ns;                        /**< Average (snapshot)    */
+    uint64_t total_ns;                      /**< Sum of all of them    */
+    uint32_t buckets[APA102_HIST_BUCKETS];  /**< log2(us) distribution */
+} apa102_histogram_t;
+
+
+/**
+ * Real-time settings applied to the renderer (might be less than requested)
+ */
+typedef struct apa102_rt_tt
+{
+    apa102_sched_t sched_policy;    /**< Policy in effect               */
+    int            sched_priority;  /**< Priority in effect             */
+    uint32_t       cpu_mask;        /**< Affinity in effect (first 32)  */
+    bool           is_mlockall;     /**< Process memory locked          */
+} apa102_rt_t;
+
+
+/**
+ * Renderer statistics
+ */
+typedef struct apa102_stats_tt
+{
+    uint64_t           frames_submitted;  /**< Finished by the producer           */
+    uint64_t           frames_sent;       /**< Transferred to the LEDs            */
+    uint64_t           frames_dropped;    /**< Superseded before sent (mailbox)   */
+    uint64_t           frames_skipped;    /**< Identical to the last sent one     */
+    uint64_t           frames_repeated;   /**< Re-dithered last frame sent on idle */
+    uint64_t           xfer_errors;       /**< Failed transfers                   */
+    uint64_t           bytes_sent;        /**< Transferred bytes                  */
+    apa102_histogram_t xfer;              /**< Transfer time                      */
+    apa102_histogram_t latency;           /**< Finish frame to transfer done      */
+    apa102_histogram_t interval;          /**< Between transfer starts (jitter)   */
+    apa102_histogram_t blocked;           /**< Producer waiting for a free frame  */
+    int                queue_depth;       /**< Frames waiting in full_frames now  */
+} apa102_stats_t;
+
+
+/**
+ * Statistics updated by one thread
+ */
+typedef struct apa102_counters_tt
+{
+    uint32_t       seq;                   /**< Odd while being updated */
+    apa102_stats_t stats;
+} apa102_counters_t;
+
+
+/**
+ * Frame (item passed through the queues)
+ */
+typedef struct apa102_frame_tt
+{
+    uint8_t  *data;                       /**< Raw frame as sent over SPI */
+    uint16_t *canvas;                     /**< Canvas snapshot (dithering) */
+    uint64_t  finish_ns;                  /**< Finished at (monotonic)    */
+    int       dirty;                      /**< Highest pixel changed      */
+    uint8_t   brightness;                 /**< Global brightness to apply */
+    uint64_t  id;                         /**< Sequence number (0: repeat) */
+} apa102_frame_t;
+
+
+/**
+ * Frame queue
+ */
+typedef struct apa102_queue_tt
+{
+    bool         is_lockfree;
+    sync_fifo_t  locked;
+    spsc_fifo_t  lockfree;
+} apa102_queue_t;
+
+
 /**
  *  APA102 context
  */
@@ -51,14 +249,41 @@ typedef struct apa102_tt
 {
     const apa102_config_t  *config;
     uint8_t                 brightness;
-    uint8_t               **frame_pool;
+    uint8_t                 prev_brightness;
+    uint8_t                *arena;
+    size_t                  arena_len;
+    apa102_frame_t         *frame_pool;
+    int                     frame_count;
     int                     frame_len;
+    apa102_frame_t         *active;
     uint8_t                *active_frame;
     uint8_t                *prev_frame;
-    sync_fifo_t             free_frames;
-    sync_fifo_t             full_frames;
+    apa102_queue_t          free_frames;
+    apa102_queue_t          full_frames;
     pthread_t               th_renderer;
     bool                    is_renderer_running;
+    apa102spi_t             spi;
+    apa102_counters_t       producer_stats;
+    apa102_counters_t       renderer_stats;
+    uint8_t                *last_sent;
+    uint64_t                last_sent_ns;
+    uint64_t                last_start_ns;
+    apa102_rt_t             rt;
+    uint64_t                frame_id;
+    uint64_t                presented_id;
+    apa102_presented_t      presented[APA102_PRESENT_HISTORY];
+    pthread_mutex_t         presented_mx;
+    pthread_cond_t          presented_cv;
+    int                     free_fd;
+    int                     presented_fd;
+    int                     pending_dirty;
+    uint8_t                *tx_frame;
+    uint16_t               *canvas;
+    struct blend_hdr_tt    *hdr;
+    uint16_t               *dither_src;
+    uint8_t                *dither_err;
+    apa102_frame_t          dither_frame;
+    uint64_t                dither_ns;
 } apa102_t;
 
 
@@ -68,12 +293,23 @@ typedef struct apa102_tt
 int  apa102_init          (apa102_t *self, const apa102_config_t *config);
 int  apa102_done          (apa102_t *self);
 int  apa102_begin_frame   (apa102_t *self, bool copy_last);
+int  apa102_try_begin_frame(apa102_t *self, bool copy_last, int timeout_ms);
 int  apa102_finish_frame  (apa102_t *self);
+int  apa102_finish_frame_id(apa102_t *self, uint64_t *id);
+int  apa102_wait_presented(apa102_t *self, uint64_t id, int timeout_ms, apa102_presented_t *presented);
 int  apa102_set_pixel     (apa102_t *self, int pixel, uint32_t argb, apa102_pix_mode_t mode);
+int  apa102_set_pixel16   (apa102_t *self, int pixel, uint64_t argb16, apa102_pix_mode_t mode);
+int  apa102_set_span      (apa102_t *self, int first, int count, const uint32_t *argb, apa102_pix_mode_t mode);
+int  apa102_set_pixels    (apa102_t *self, const int *pixel, const uint32_t *argb, int count, apa102_pix_mode_t mode);
 int  apa102_get_pixel     (apa102_t *self, int pixel, uint32_t *argb);
+int  apa102_set_pixel_brightness(apa102_t *self, int pixel, uint8_t brightness);
 void apa102_clear         (apa102_t *self);
 void apa102_fill          (apa102_t *self, uint32_t argb);
 void apa102_set_brightness(apa102_t *self, uint8_t brightness);
+void apa102_get_stats     (apa102_t *self, apa102_stats_t *stats);
+void apa102_get_rt        (apa102_t *self, apa102_rt_t *rt);
+int  apa102_get_free_fd   (apa102_t *self);
+int  apa102_get_presented_fd(apa102_t *self);
 
 
 #endif
@@ -0,0 +1,2058 @@
+/*************************************************************************//**
+ * @file apa102_bench.c
+ *
+ *     Rendering pipeline measurements, runs without the real hardware when
+ *     the null (or file/pipe) backend is chosen.
+ *
+ *     Usage: apa102_bench [-m mode] [-b backend] [-d device[,device...]]
+ *                         [-s speed] [-n pixels] [-f frames] [-c chains]
+ *                         [-q queue] [-p present] [-k depth] [-u keepalive]
+ *                         [-z] [-x] [-w width] [-v] [-e encode]
+ *                         [-t hz] [-l] [-g] [-r policy] [-y priority]
+ *                         [-a cpumask] [-L]
+ *
+ *     Modes:
+ *         renderer: frames pushed through the whole pipeline (default).
+ *                   Pixels are spread evenly over the chains, each chain uses
+ *                   its own device from the list (the last one is repeated if
+ *                   the list is short).
+ *         chunk:    SPI layer throughput against the transfer chunk size
+ *                   (meaningful for spidev backend only).
+ *         queue:    frame handoff latency (ping-pong between two threads) and
+ *                   throughput of the locked and lock-free FIFOs.
+ *         span:     painting per pixel against the span and scatter calls
+ *                   (and the inlined view setters for copy/add/xor), for
+ *                   every combination mode at 256, 4k and 64k pixels
+ *                   (results are cross-checked).
+ *         encode:   canvas encoding cost and the number of distinct light
+ *                   levels a dim ramp gets, raw against HDR.
+ *         dither:   temporal dithering encoders against the plain ones at
+ *                   256, 4k and 64k pixels, with the error of the average
+ *                   over 256 frames.
+ *         pace:     frame pacer at 200 fps with every 16th frame rendered
+ *                   too slowly, drop against slip policy (wake-up lateness,
+ *                   achieved rate).
+ *         alloc:    steady state check, no heap allocation and no page fault
+ *                   may happen while the frames are painted and sent (the
+ *                   renderer mode options apply, fails otherwise).
+ *         present:  finish to on-wire latency, each frame is waited for
+ *                   (apa102_wait_presented()), the callback counts what
+ *                   happened to the frames (the renderer mode options apply).
+ *         direct:   present mode latency, threaded (fifo) against direct
+ *                   (no renderer thread).
+ *         display:  64x32 wall of eight 16x16 modules (every anchor), the
+ *                   display_set_pixel() lookup table against the per pixel
+ *                   module search and zig-zag maths it replaced, image blit
+ *                   against per pixel painting (all cross-checked). The
+ *                   modules are dealt to the chains (devices as in renderer
+ *                   mode) sent in parallel, skew of their last transfers.
+ *         draw:     drawing primitives on the display mode's wall, lines,
+ *                   circles and rectangles (clipped, every pixel mode)
+ *                   against per pixel references, display_test's nested
+ *                   rectangles per pixel against display_rect().
+ *         pixmap:   pixel map of diagonal strips (pixels LEDs) loaded by
+ *                   display_init(), parsed and cached first, then mapped
+ *                   from the cache (both cross-checked).
+ *         poll:     single threaded event loop (epoll), a 200 Hz timer asks
+ *                   for frames, apa102_try_begin_frame() and the eventfds
+ *                   deliver them without blocking (the renderer mode options
+ *                   apply, -s makes the transfers the bottleneck).
+ *
+ *     Renderer mode options:
+ *         queue:   locked (default), lockfree
+ *         present: fifo (default), mailbox, direct
+ *         depth:   number of frames in the pool (0: library default)
+ *         -u:      skip frames identical to the last sent one, resend after
+ *                  keepalive milliseconds (0: never)
+ *         -z:      static content (all frames are the same)
+ *         -x:      send only the changed start of the chain
+ *         width:   continue the previous frame and repaint only the first
+ *                  width pixels (0: repaint whole chain from scratch)
+ *         -v:      paint into the 16 bit canvas (span mode too)
+ *         encode:  raw (default), hdr (implies -v)
+ *         hz:      dither in the renderer, re-dither the last frame at hz when
+ *                  idle (0: dither just new frames, implies -v)
+ *         -l:      mlock() the frame arena
+ *         -g:      frame arena in hugepages
+ *         policy:  renderer scheduling, other (default), fifo, rr (direct:
+ *                  the bench's own thread, is_rt_caller)
+ *         priority: renderer priority for fifo/rr
+ *         cpumask: renderer CPU affinity (e.g. 0x2, 0: any)
+ *         -L:      mlockall() the process
+ *
+ *     Transfer interval spread (with -s and the null backend, the transfers
+ *     take fixed time) shows the renderer's scheduling jitter.
+ *
+ ****************************************************************************/
+#include <stdlib.h>
+#include <stdio.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <limits.h>
+#include <string.h>
+#include <unistd.h>
+#include <time.h>
+#include <pthread.h>
+#include <malloc.h>
+#include <sys/resource.h>
+#include <sys/epoll.h>
+#include <sys/timerfd.h>
+#include "sync_fifo.h"
+#include "spsc_fifo.h"
+#include "apa102.h"
+#include "apa102_inline.h"
+#include "display.h"
+#include "pacer.h"
+#include "colors.h"
+#include "blend.h"
+#include "debug.h"
+
+
+/*****************************************************************************
+ * Private macros
+ ****************************************************************************/
+#define DEFAULT_MODE    "renderer"
+#define DEFAULT_BACKEND "null"
+#define DEFAULT_DEVICE  "/dev/null"
+#define DEFAULT_SPEED   0
+#define DEFAULT_PIXELS  10000
+#define DEFAULT_FRAMES  2000
+#define DEFAULT_CHAINS  1
+#define MAX_CHAINS      16
+#define BRIGHTNESS      2
+#define MIN_CHUNK       64
+#define QUEUE_SIZE      8
+#define QUEUE_ROUNDS    100  /* queue mode iterations per "frame" */
+#define SPAN_ROUNDS     8192 /* span mode pixels per "frame"        */
+#define DITHER_FRAMES   256  /* dither mode frames averaged         */
+#define PACE_FPS        200  /* pace mode target rate               */
+#define PACE_SLOW       16   /* pace mode: every n-th frame is slow */
+#define POLL_FPS        200  /* poll mode timer rate                */
+#define WALL_WIDTH      64   /* display mode wall                   */
+#define WALL_HEIGHT     32
+#define WALL_MODULE     16   /* display mode module side            */
+#define WALL_MODULES    ((WALL_WIDTH / WALL_MODULE) * (WALL_HEIGHT / WALL_MODULE))
+#define PIXMAP_FILE     "/tmp/apa102_bench.map"
+#define PIXMAP_CACHE    "/tmp/apa102_bench.lut"
+
+
+/*****************************************************************************
+ * Private types
+ ****************************************************************************/
+
+
+/**
+ * Benchmark options
+ */
+typedef struct bench_options_tt
+{
+    const char *mode;
+    const char *backend;
+    const char *device;
+    int         speed;
+    int         pixels;
+    int         frames;
+    int         chains;
+    const char *queue;
+    const char *present;
+    int         depth;
+    int         keepalive;
+    bool        is_static;
+    bool        is_prefix;
+    int         width;
+    bool        is_canvas;
+    const char *encode;
+    int         dither_hz;
+    bool        is_locked;
+    bool        is_hugepages;
+    const char *policy;
+    int         priority;
+    uint32_t    cpu_mask;
+    bool        is_mlockall;
+} bench_options_t;
+
+
+/**
+ * Either of the FIFOs
+ */
+typedef struct bench_queue_tt
+{
+    bool        is_lockfree;
+    sync_fifo_t locked;
+    spsc_fifo_t lockfree;
+} bench_queue_t;
+
+
+/**
+ * Span benchmark mode
+ */
+typedef struct bench_span_mode_tt
+{
+    const char        *name;
+    apa102_pix_mode_t  mode;
+} bench_span_mode_t;
+
+
+/**
+ * Queue benchmark context (shared by both threads)
+ */
+typedef struct bench_queue_ctx_tt
+{
+    bench_queue_t ping;
+    bench_queue_t pong;
+    int           rounds;
+} bench_queue_ctx_t;
+
+
+/*****************************************************************************
+ * Private variables
+ ****************************************************************************/
+static const bench_span_mode_t span_modes[] =
+{
+    {"copy", APA102_PIX_MODE_COPY},
+    {"add",  APA102_PIX_MODE_ADD },
+    {"sub",  APA102_PIX_MODE_SUB },
+    {"sub2", APA102_PIX_MODE_SUB2},
+    {"xor",  APA102_PIX_MODE_XOR },
+    {"inv2", APA102_PIX_MODE_INV2},
+};
+
+static const int span_sizes[] = {256, 4096, 65536};
+
+
+/*****************************************************************************
+ * Private functions
+ ****************************************************************************/
+
+
+static uint64_t get_ns(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+
+    return ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+
+static void usage(const char *name)
+{
+    fprintf(stderr, "Usage: %s [-m mode] [-b backend] [-d device[,device...]] [-s speed] [-n pixels] [-f frames] [-c chains] [-q queue] [-p present] [-k depth] [-u keepalive] [-z] [-x] [-w width] [-v] [-e encode] [-t hz]\n", name);
+    fprintf(stderr, "    mode:    renderer, chunk, queue, span, encode, dither, pace, alloc, present, direct, display, pixmap, poll (default %s)\n", DEFAULT_MODE);
+    fprintf(stderr, "    queue:   locked, lockfree (default locked)\n");
+    fprintf(stderr, "    present: fifo, mailbox, direct (default fifo)\n");
+    fprintf(stderr, "    encode:  raw, hdr (default raw)\n");
+    fprintf(stderr, "    policy:  other, fifo, rr (default other)\n");
+    fprintf(stderr, "    backend: spidev, file, pipe, null (default %s)\n", DEFAULT_BACKEND);
+}
+
+
+static void print_hist(const char *name, const apa102_histogram_t *hist)
+{
+    int i;
+    int last = 0;
+
+    printf("    %-8s min %8.1f  avg %8.1f  max %8.1f us, log2(us):", name, hist->min_ns / 1e3, hist->avg_ns / 1e3, hist->max_ns / 1e3);
+    for (i = 0; i < APA102_HIST_BUCKETS; ++i)
+    {
+        if (hist->buckets[i] != 0)
+            last = i;
+    }
+    for (i = 0; i <= last; ++i)
+    {
+        printf(" %u", hist->buckets[i]);
+    }
+    printf("\n");
+}
+
+
+static void print_stats(apa102_t *leds)
+{
+    static const char *policies[] = {"other", "fifo", "rr"};
+    apa102_stats_t     stats;
+    apa102_rt_t        rt;
+
+    apa102_get_stats(leds, &stats);
+    apa102_get_rt(leds, &rt);
+
+    printf("    renderer: %s, priority %d, CPUs 0x%x%s\n", policies[rt.sched_policy], rt.sched_priority, rt.cpu_mask, rt.is_mlockall ? ", mlockall" : "");
+
+    printf("    frames: %llu submitted, %llu sent, %llu dropped, %llu skipped, %llu repeated, %llu errors, %d queued, %llu bytes sent\n",
+           (unsigned long long)stats.frames_submitted, (unsigned long long)stats.frames_sent,
+           (unsigned long long)stats.frames_dropped, (unsigned long long)stats.frames_skipped,
+           (unsigned long long)stats.frames_repeated,
+           (unsigned long long)stats.xfer_errors, stats.queue_depth, (unsigned long long)stats.bytes_sent);
+    print_hist("xfer", &stats.xfer);
+    print_hist("latency", &stats.latency);
+    print_hist("interval", &stats.interval);
+    printf("    jitter   %8.1f us (max - min interval)\n", (stats.interval.max_ns - stats.interval.min_ns) / 1e3);
+    print_hist("blocked", &stats.blocked);
+}
+
+
+static apa102_config_t get_config(const bench_options_t *opt, const apa102spi_backend_t *backend, const char *device, int pixels)
+{
+    apa102_config_t config =
+    {
+        .spi_device   = device,
+        .spi_speed    = opt->speed,
+        .pixel_count  = pixels,
+        .brightness   = BRIGHTNESS,
+        .backend      = backend,
+        .queue        = (strcmp(opt->queue, "lockfree") == 0) ? APA102_QUEUE_LOCKFREE : APA102_QUEUE_LOCKED,
+        .present_mode = (strcmp(opt->present, "mailbox") == 0) ? APA102_PRESENT_MAILBOX : ((strcmp(opt->present, "direct") == 0) ? APA102_PRESENT_DIRECT : APA102_PRESENT_FIFO),
+        .frame_count  = opt->depth,
+        .is_skip_same = (opt->keepalive >= 0),
+        .keepalive_ms = opt->keepalive,
+        .is_prefix    = opt->is_prefix,
+        .is_canvas    = opt->is_canvas,
+        .encode       = (strcmp(opt->encode, "hdr") == 0) ? APA102_ENCODE_HDR : APA102_ENCODE_RAW,
+        .is_dither    = (opt->dither_hz >= 0),
+        .dither_hz    = opt->dither_hz,
+        .is_locked    = opt->is_locked,
+        .is_hugepages = opt->is_hugepages,
+        .sched_policy = (strcmp(opt->policy, "fifo") == 0) ? APA102_SCHED_FIFO : ((strcmp(opt->policy, "rr") == 0) ? APA102_SCHED_RR : APA102_SCHED_DEFAULT),
+        .sched_priority = opt->priority,
+        .cpu_mask     = opt->cpu_mask,
+        .is_mlockall  = opt->is_mlockall,
+        .is_rt_caller = (strcmp(opt->present, "direct") == 0),
+    };
+
+    return config;
+}
+
+
+static int bench_renderer(const bench_options_t *opt)
+{
+    const apa102spi_backend_t *backend = apa102spi_find_backend(opt->backend);
+    apa102_config_t            config[MAX_CHAINS];
+    apa102_t                   leds[MAX_CHAINS];
+    char                       devices[256];
+    char                      *device  = NULL;
+    int                        pixels  = opt->pixels / opt->chains;
+    uint64_t                   start;
+    uint64_t                   blocked = 0;
+    double                     elapsed;
+    int                        frame;
+    int                        c;
+
+    if (backend == NULL)
+    {
+        fprintf(stderr, "Unknown backend %s\n", opt->backend);
+        return -1;
+    }
+
+    snprintf(devices, sizeof(devices), "%s", opt->device);
+    for (c = 0; c < opt->chains; ++c)
+    {
+        char *next = strtok((c == 0) ? devices : NULL, ",");
+
+        device    = (next != NULL) ? next : device;
+        config[c] = get_config(opt, backend, device, pixels);
+
+        if (apa102_init(&leds[c], &config[c]) != 0)
+        {
+            fprintf(stderr, "Cannot init APA102 library (chain %d)!\n", c);
+            while (c-- > 0)
+                apa102_done(&leds[c]);
+            return -1;
+        }
+    }
+
+    start = get_ns();
+    for (frame = 0; frame < opt->frames; ++frame)
+    {
+        for (c = 0; c < opt->chains; ++c)
+        {
+            uint64_t t0 = get_ns();
+            int      count = ((opt->width > 0) && (opt->width < pixels)) ? opt->width : pixels;
+            int      i;
+
+            apa102_begin_frame(&leds[c], opt->width > 0);
+            blocked += get_ns() - t0;
+
+            for (i = 0; i < count; ++i)
+            {
+                int f = opt->is_static ? 0 : frame;
+
+                apa102_set_pixel(&leds[c], i, COL_ARGB(0xff, f, i, f + i), APA102_PIX_MODE_COPY);
+            }
+
+            t0 = get_ns();
+            apa102_finish_frame(&leds[c]);
+            blocked += get_ns() - t0;
+        }
+    }
+    elapsed = (get_ns() - start) / 1e9;
+
+    printf("renderer: %s, %s queue, %s, depth %d, %d chain(s) x %d pixels, %d frames\n", backend->name, opt->queue, opt->present, leds[0].frame_count, opt->chains, pixels, opt->frames);
+    printf("    %10.1f fps\n", opt->frames / elapsed);
+    printf("    %10.1f us/frame\n", elapsed * 1e6 / opt->frames);
+    printf("    %10.1f us/frame producer blocked\n", blocked / 1e3 / opt->frames);
+    printf("    %10.2f MB/s pixel data\n", (double)opt->frames * pixels * opt->chains * 4 / elapsed / 1e6);
+
+    for (c = 0; c < opt->chains; ++c)
+    {
+        apa102_done(&leds[c]);
+        printf("  chain %d:\n", c);
+        print_stats(&leds[c]);
+    }
+
+    return 0;
+}
+
+
+static int bench_chunk(const bench_options_t *opt)
+{
+    const apa102spi_backend_t *backend = apa102spi_find_backend(opt->backend);
+    apa102spi_t                spi;
+    int                        length  = 8 + opt->pixels * 4 + opt->pixels / 16;
+    uint8_t                   *data;
+    int                        chunk;
+
+    if (backend == NULL)
+    {
+        fprintf(stderr, "Unknown backend %s\n", opt->backend);
+        return -1;
+    }
+
+    if (apa102spi_open(&spi, backend, opt->device, opt->speed) != 0)
+        return -1;
+
+    data = (uint8_t *)calloc(length, 1);
+
+    printf("chunk: %s, %d bytes/frame, %d frames\n", backend->name, length, opt->frames);
+    for (chunk = MIN_CHUNK; ; chunk *= 2)
+    {
+        int      used  = apa102spi_set_chunk_len(&spi, chunk);
+        uint64_t start = get_ns();
+        double   elapsed;
+        int      frame;
+
+        for (frame = 0; frame < opt->frames; ++frame)
+        {
+            if (apa102spi_update(&spi, data, length) != 0)
+            {
+                fprintf(stderr, "Transfer failed\n");
+                break;
+            }
+        }
+        elapsed = (get_ns() - start) / 1e9;
+
+        printf("    %6d B chunk: %12.0f B/s, %8.1f us/frame\n", used, (double)frame * length / elapsed, elapsed * 1e6 / opt->frames);
+
+        if (used < chunk)
+            break;
+    }
+
+    free(data);
+    apa102spi_close(&spi);
+
+    return 0;
+}
+
+
+static void queue_init(bench_queue_t *queue, bool is_lockfree)
+{
+    queue->is_lockfree = is_lockfree;
+
+    if (is_lockfree)
+        spsc_fifo_init(&queue->lockfree, QUEUE_SIZE, "bench");
+    else
+        sync_fifo_init(&queue->locked, QUEUE_SIZE, "bench");
+}
+
+
+static void queue_done(bench_queue_t *queue)
+{
+    if (queue->is_lockfree)
+        spsc_fifo_done(&queue->lockfree);
+    else
+        sync_fifo_done(&queue->locked);
+}
+
+
+static void queue_put(bench_queue_t *queue, void *item)
+{
+    if (queue->is_lockfree)
+        spsc_fifo_put(&queue->lockfree, item, true);
+    else
+        sync_fifo_put(&queue->locked, item, true);
+}
+
+
+static void *queue_get(bench_queue_t *queue)
+{
+    void *item = NULL;
+
+    if (queue->is_lockfree)
+        spsc_fifo_get(&queue->lockfree, &item, true);
+    else
+        sync_fifo_get(&queue->locked, &item, true);
+
+    return item;
+}
+
+
+static void *queue_echo(void *arg)
+{
+    bench_queue_ctx_t *ctx = (bench_queue_ctx_t *)arg;
+    int                i;
+
+    for (i = 0; i < ctx->rounds; ++i)
+    {
+        queue_put(&ctx->pong, queue_get(&ctx->ping));
+    }
+
+    return NULL;
+}
+
+
+static void *queue_drain(void *arg)
+{
+    bench_queue_ctx_t *ctx = (bench_queue_ctx_t *)arg;
+    int                i;
+
+    for (i = 0; i < ctx->rounds; ++i)
+    {
+        queue_get(&ctx->ping);
+    }
+
+    return NULL;
+}
+
+
+static void bench_queue_type(int rounds, bool is_lockfree)
+{
+    bench_queue_ctx_t ctx = {.rounds = rounds};
+    pthread_t         th;
+    uint64_t          start;
+    double            pingpong;
+    double            stream;
+    int               i;
+
+    queue_init(&ctx.ping, is_lockfree);
+    queue_init(&ctx.pong, is_lockfree);
+
+    /* Round trip, like a frame going to the renderer and back */
+    pthread_create(&th, NULL, queue_echo, &ctx);
+    start = get_ns();
+    for (i = 0; i < rounds; ++i)
+    {
+        queue_put(&ctx.ping, &ctx);
+        queue_get(&ctx.pong);
+    }
+    pingpong = (get_ns() - start) / 2.0 / rounds;
+    pthread_join(th, NULL);
+
+    /* One way stream, the consumer keeps up as it can */
+    pthread_create(&th, NULL, queue_drain, &ctx);
+    start = get_ns();
+    for (i = 0; i < rounds; ++i)
+    {
+        queue_put(&ctx.ping, &ctx);
+    }
+    pthread_join(th, NULL);
+    stream = (double)(get_ns() - start) / rounds;
+
+    queue_done(&ctx.pong);
+    queue_done(&ctx.ping);
+
+    printf("    %-8s %10.1f ns/handoff (ping-pong), %10.1f ns/item (stream)\n", is_lockfree ? "lockfree" : "locked", pingpong, stream);
+}
+
+
+static int bench_queue(const bench_options_t *opt)
+{
+    int rounds = opt->frames * QUEUE_ROUNDS;
+
+    printf("queue: %d items, depth %d\n", rounds, QUEUE_SIZE);
+    bench_queue_type(rounds, false);
+    bench_queue_type(rounds, true);
+
+    return 0;
+}
+
+
+static bool is_view_mode(apa102_pix_mode_t mode)
+{
+    return (mode == APA102_PIX_MODE_COPY) || (mode == APA102_PIX_MODE_ADD) || (mode == APA102_PIX_MODE_XOR);
+}
+
+
+static void span_view(const apa102_view_t *view, const uint32_t *argb, int count, apa102_pix_mode_t mode)
+{
+    int i;
+
+    switch (mode)
+    {
+        case APA102_PIX_MODE_COPY: for (i = 0; i < count; ++i) apa102_view_copy(view, i, argb[i]); break;
+        case APA102_PIX_MODE_ADD:  for (i = 0; i < count; ++i) apa102_view_add (view, i, argb[i]); break;
+        case APA102_PIX_MODE_XOR:  for (i = 0; i < count; ++i) apa102_view_xor (view, i, argb[i]); break;
+        default:                                                                                  break;
+    }
+}
+
+
+static void span_paint(apa102_t *leds, int kind, const int *index, const uint32_t *argb, int count, apa102_pix_mode_t mode)
+{
+    apa102_view_t view;
+    int           i;
+
+    switch (kind)
+    {
+        case 0:
+            for (i = 0; i < count; ++i)
+            {
+                apa102_set_pixel(leds, i, argb[i], mode);
+            }
+            break;
+
+        case 1:
+            apa102_set_span(leds, 0, count, argb, mode);
+            break;
+
+        case 2:
+            apa102_set_pixels(leds, index, argb, count, mode);
+            break;
+
+        case 3:
+            if (apa102_get_view(leds, &view) == 0)
+                span_view(&view, argb, count, mode);
+            break;
+    }
+}
+
+
+static int bench_span_size(const bench_options_t *opt, int pixels)
+{
+    apa102_config_t  config   = {.spi_device = DEFAULT_DEVICE, .pixel_count = pixels, .brightness = BRIGHTNESS, .backend = apa102spi_find_backend("null"), .is_canvas = opt->is_canvas};
+    apa102_t         leds;
+    int              rounds   = (int)((long long)opt->frames * SPAN_ROUNDS / pixels);
+    int              len      = opt->is_canvas ? pixels * 8 : pixels * 4;
+    uint32_t        *argb     = (uint32_t *)malloc(pixels * sizeof(uint32_t));
+    uint32_t        *shuffled = (uint32_t *)malloc(pixels * sizeof(uint32_t));
+    int             *index    = (int *)malloc(pixels * sizeof(int));
+    uint8_t         *ref      = (uint8_t *)malloc(len);
+    int              ret      = 0;
+    int              m;
+    int              i;
+
+    if (apa102_init(&leds, &config) != 0)
+    {
+        fprintf(stderr, "Cannot init APA102 library!\n");
+        free(argb);
+        free(shuffled);
+        free(index);
+        free(ref);
+        return -1;
+    }
+
+    if (rounds < 1)
+        rounds = 1;
+
+    /* Both default and own brightness, scatter order shuffled */
+    srand(pixels);
+    for (i = 0; i < pixels; ++i)
+    {
+        argb[i]  = ((uint32_t)rand() << 16) ^ (uint32_t)rand();
+        index[i] = i;
+    }
+    for (i = pixels - 1; i > 0; --i)
+    {
+        int j   = rand() % (i + 1);
+        int tmp = index[i];
+
+        index[i] = index[j];
+        index[j] = tmp;
+    }
+    for (i = 0; i < pixels; ++i)
+    {
+        shuffled[i] = argb[index[i]];
+    }
+
+    printf("  %d pixels, %d rounds%s:\n", pixels, rounds, opt->is_canvas ? ", canvas" : "");
+    for (m = 0; m < sizeof(span_modes) / sizeof(span_modes[0]); ++m)
+    {
+        double ns[4]   = {0.0};
+        bool   is_same = true;
+        bool   is_view = !opt->is_canvas && is_view_mode(span_modes[m].mode);
+        int    kinds   = is_view ? 4 : 3;
+        int    kind;
+        char   view[32] = "";
+
+        apa102_begin_frame(&leds, false);
+        for (kind = 0; kind < kinds; ++kind)
+        {
+            const uint32_t *colors = (kind == 2) ? shuffled : argb;
+            uint8_t        *data;
+            uint64_t        start;
+            int             r;
+
+            /* Same start, one pass, compare to the per pixel result */
+            apa102_fill(&leds, COL_ARGB(0x10, 0x80, 0x20, 0xf0));
+            span_paint(&leds, kind, index, colors, pixels, span_modes[m].mode);
+            data = opt->is_canvas ? (uint8_t *)leds.canvas : leds.active_frame + 4;
+            if (kind == 0)
+                memcpy(ref, data, len);
+            else if (memcmp(ref, data, len) != 0)
+                is_same = false;
+
+            start = get_ns();
+            for (r = 0; r < rounds; ++r)
+            {
+                span_paint(&leds, kind, index, colors, pixels, span_modes[m].mode);
+            }
+            ns[kind] = (double)(get_ns() - start) / rounds / pixels;
+        }
+        apa102_finish_frame(&leds);
+
+        if (is_view)
+            snprintf(view, sizeof(view), ", %7.2f ns/px view (x%5.1f)", ns[3], ns[0] / ns[3]);
+
+        printf("    %-4s %7.2f ns/px per pixel, %7.2f ns/px span (x%5.1f), %7.2f ns/px scatter (x%5.1f)%s%s\n",
+               span_modes[m].name, ns[0], ns[1], ns[0] / ns[1], ns[2], ns[0] / ns[2], view, is_same ? "" : "  MISMATCH");
+        if (!is_same)
+            ret = -1;
+    }
+
+    apa102_done(&leds);
+    free(argb);
+    free(shuffled);
+    free(index);
+    free(ref);
+
+    return ret;
+}
+
+
+static int bench_span(const bench_options_t *opt)
+{
+    int ret = 0;
+    int i;
+
+    printf("span:\n");
+    for (i = 0; i < sizeof(span_sizes) / sizeof(span_sizes[0]); ++i)
+    {
+        if (bench_span_size(opt, span_sizes[i]) != 0)
+            ret = -1;
+    }
+
+    return ret;
+}
+
+
+static int bench_encode_type(const bench_options_t *opt, apa102_encode_t encode)
+{
+    apa102_config_t  config = {.spi_device = DEFAULT_DEVICE, .pixel_count = opt->pixels, .brightness = BRIGHTNESS, .backend = apa102spi_find_backend("null"), .is_canvas = true, .encode = encode};
+    apa102_t         leds;
+    bool             levels[31 * 255 + 1] = {false};
+    int              count  = 0;
+    uint64_t         start;
+    double           elapsed;
+    const uint8_t   *data;
+    int              frame;
+    int              i;
+
+    if (apa102_init(&leds, &config) != 0)
+    {
+        fprintf(stderr, "Cannot init APA102 library!\n");
+        return -1;
+    }
+
+    /* The darkest eighth of the range, full brightness */
+    start = get_ns();
+    for (frame = 0; frame < opt->frames; ++frame)
+    {
+        apa102_begin_frame(&leds, true);
+        for (i = 0; i < opt->pixels; ++i)
+        {
+            uint16_t v = (uint16_t)((uint64_t)i * 0x2000 / opt->pixels);
+
+            apa102_set_pixel16(&leds, i, COL_ARGB16(31, v, v, v), APA102_PIX_MODE_COPY);
+        }
+        apa102_finish_frame(&leds);
+    }
+    elapsed = (get_ns() - start) / 1e9;
+
+    /* Finished frame is not touched until the next begin */
+    data = leds.prev_frame + 4;
+    for (i = 0; i < opt->pixels; ++i)
+    {
+        int level = (data[i * 4] & 0x1f) * data[i * 4 + 1];
+
+        if (!levels[level])
+            ++count;
+        levels[level] = true;
+    }
+
+    apa102_done(&leds);
+
+    printf("    %-4s %8.1f us/frame (paint + encode), %5d distinct levels in the ramp\n", (encode == APA102_ENCODE_HDR) ? "hdr" : "raw", elapsed * 1e6 / opt->frames, count);
+
+    return 0;
+}
+
+
+static int bench_encode(const bench_options_t *opt)
+{
+    printf("encode: %d pixels, %d frames\n", opt->pixels, opt->frames);
+    if (bench_encode_type(opt, APA102_ENCODE_RAW) != 0)
+        return -1;
+
+    return bench_encode_type(opt, APA102_ENCODE_HDR);
+}
+
+
+static int bench_dither_size(const bench_options_t *opt, int pixels, const blend_hdr_t *hdr)
+{
+    int       lanes  = pixels * CANVAS_LANES;
+    int       rounds = (int)((long long)opt->frames * SPAN_ROUNDS / pixels);
+    uint16_t *canvas = (uint16_t *)malloc(lanes * sizeof(uint16_t));
+    uint8_t  *err    = (uint8_t *)calloc(lanes, sizeof(uint8_t));
+    uint8_t  *wire   = (uint8_t *)malloc(lanes);
+    uint32_t *sum    = (uint32_t *)calloc(lanes, sizeof(uint32_t));
+    double    ns[4];
+    double    avg_err = 0.0;
+    int       kind;
+    int       i;
+
+    if (rounds < 1)
+        rounds = 1;
+
+    srand(pixels);
+    for (i = 0; i < lanes; ++i)
+    {
+        canvas[i] = ((i % CANVAS_LANES) == 0) ? BRIGHT_MAX : (uint16_t)rand();
+    }
+
+    for (kind = 0; kind < 4; ++kind)
+    {
+        uint64_t start = get_ns();
+        int      r;
+
+        for (r = 0; r < rounds; ++r)
+        {
+            switch (kind)
+            {
+                case 0: blend16_encode  (wire, canvas, pixels, BRIGHT_MAX);           break;
+                case 1: blend16_dither  (wire, canvas, err, pixels, BRIGHT_MAX);      break;
+                case 2: blend_hdr_encode(wire, canvas, pixels, BRIGHT_MAX, hdr);      break;
+                case 3: blend_hdr_dither(wire, canvas, err, pixels, BRIGHT_MAX, hdr); break;
+            }
+        }
+        ns[kind] = (double)(get_ns() - start) / rounds / pixels;
+    }
+
+    /* Average of the dithered 8 bit channels should give the 16 bit ones */
+    memset(err, 0, lanes);
+    for (i = 0; i < DITHER_FRAMES; ++i)
+    {
+        int j;
+
+        blend16_dither(wire, canvas, err, pixels, BRIGHT_MAX);
+        for (j = 0; j < lanes; ++j)
+        {
+            sum[j] += wire[j];
+        }
+    }
+    for (i = 0; i < lanes; ++i)
+    {
+        if ((i % CANVAS_LANES) != 0)
+            avg_err += abs((int)sum[i] - (int)canvas[i]) / 256.0;
+    }
+    avg_err /= pixels * (CANVAS_LANES - 1);
+
+    printf("  %6d pixels: raw %6.2f ns/px, dithered %6.2f ns/px, hdr %6.2f ns/px, hdr dithered %6.2f ns/px, avg error %.4f (8 bit units)\n",
+           pixels, ns[0], ns[1], ns[2], ns[3], avg_err);
+
+    free(canvas);
+    free(err);
+    free(wire);
+    free(sum);
+
+    return 0;
+}
+
+
+static int bench_dither(const bench_options_t *opt)
+{
+    blend_hdr_t hdr;
+    int         i;
+
+    blend_hdr_init(&hdr, 0.0);
+
+    printf("dither:\n");
+    for (i = 0; i < sizeof(span_sizes) / sizeof(span_sizes[0]); ++i)
+    {
+        bench_dither_size(opt, span_sizes[i], &hdr);
+    }
+
+    return 0;
+}
+
+
+static void bench_pace_policy(const bench_options_t *opt, pacer_policy_t policy)
+{
+    pacer_t            pacer;
+    apa102_histogram_t late = {0};
+    uint64_t           start;
+    uint64_t           frame_ns;
+    double             elapsed;
+    int                frame;
+
+    pacer_init(&pacer, PACE_FPS, policy);
+    late.min_ns = UINT64_MAX;
+
+    start = get_ns();
+    for (frame = 0; frame < opt->frames; ++frame)
+    {
+        uint64_t lateness;
+
+        pacer_wait(&pacer, &frame_ns);
+        lateness = get_ns() - frame_ns;
+
+        late.count    += 1;
+        late.total_ns += lateness;
+        late.min_ns    = (lateness < late.min_ns) ? lateness : late.min_ns;
+        late.max_ns    = (lateness > late.max_ns) ? lateness : late.max_ns;
+
+        /* Producer falling behind now and then */
+        if ((frame % PACE_SLOW) == PACE_SLOW - 1)
+        {
+            struct timespec ts = {.tv_sec = 0, .tv_nsec = pacer.period_ns * 5 / 2};
+
+            nanosleep(&ts, NULL);
+        }
+    }
+    elapsed = (get_ns() - start) / 1e9;
+    late.avg_ns = late.total_ns / late.count;
+
+    printf("    %-4s %8.1f fps, %llu frames, %llu dropped, %llu slipped, %6.2f s, wake-up late min %6.1f avg %6.1f max %8.1f us\n",
+           (policy == PACER_POLICY_DROP) ? "drop" : "slip", opt->frames / elapsed,
+           (unsigned long long)pacer.frames, (unsigned long long)pacer.dropped, (unsigned long long)pacer.slipped, elapsed,
+           late.min_ns / 1e3, late.avg_ns / 1e3, late.max_ns / 1e3);
+}
+
+
+static int bench_pace(const bench_options_t *opt)
+{
+    printf("pace: %d fps target, every %d. frame 2.5 periods long\n", PACE_FPS, PACE_SLOW);
+    bench_pace_policy(opt, PACER_POLICY_DROP);
+    bench_pace_policy(opt, PACER_POLICY_SLIP);
+
+    return 0;
+}
+
+
+static void alloc_paint(apa102_t *leds, int frame, const int *index, const uint32_t *argb, int pixels)
+{
+    apa102_begin_frame(leds, (frame & 1) != 0);
+    apa102_fill(leds, COL_ARGB(0xff, frame, 0, 0));
+    apa102_set_span(leds, 0, pixels / 2, argb, APA102_PIX_MODE_ADD);
+    apa102_set_pixels(leds, index, argb, pixels / 2, APA102_PIX_MODE_XOR);
+    apa102_set_pixel(leds, frame % pixels, COL_ARGB(0x1f, 0xff, 0xff, 0xff), APA102_PIX_MODE_COPY);
+    apa102_set_brightness(leds, frame % (BRIGHTNESS + 1));
+    apa102_finish_frame(leds);
+}
+
+
+/*
+ * Heap in use (main arena, so the producer's one) and minor page faults of
+ * the whole process, the renderer included. Warmed up first, the first
+ * frames touch the stacks and the FIFO internals.
+ */
+static int bench_alloc(const bench_options_t *opt)
+{
+    const apa102spi_backend_t *backend = apa102spi_find_backend(opt->backend);
+    apa102_config_t            config;
+    apa102_t                   leds;
+    int                        pixels  = opt->pixels;
+    uint32_t                  *argb    = (uint32_t *)malloc(pixels * sizeof(uint32_t));
+    int                       *index   = (int *)malloc(pixels * sizeof(int));
+    struct mallinfo2           heap[2];
+    struct rusage              usage[2];
+    long                       faults;
+    long                       heap_diff;
+    int                        frame;
+    int                        i;
+
+    if (backend == NULL)
+    {
+        fprintf(stderr, "Unknown backend %s\n", opt->backend);
+        free(argb);
+        free(index);
+        return -1;
+    }
+
+    config = get_config(opt, backend, opt->device, pixels);
+    if (apa102_init(&leds, &config) != 0)
+    {
+        fprintf(stderr, "Cannot init APA102 library!\n");
+        free(argb);
+        free(index);
+        return -1;
+    }
+
+    for (i = 0; i < pixels; ++i)
+    {
+        argb[i]  = ((uint32_t)rand() << 16) ^ (uint32_t)rand();
+        index[i] = (i * 7) % pixels;
+    }
+
+    for (frame = 0; frame < 2 * leds.frame_count; ++frame)
+    {
+        alloc_paint(&leds, frame, index, argb, pixels);
+    }
+
+    heap[0] = mallinfo2();
+    getrusage(RUSAGE_SELF, &usage[0]);
+    for (; frame < opt->frames; ++frame)
+    {
+        alloc_paint(&leds, frame, index, argb, pixels);
+    }
+    heap[1] = mallinfo2();
+    getrusage(RUSAGE_SELF, &usage[1]);
+
+    faults    = usage[1].ru_minflt - usage[0].ru_minflt + usage[1].ru_majflt - usage[0].ru_majflt;
+    heap_diff = (long)(heap[1].uordblks + heap[1].hblkhd) - (long)(heap[0].uordblks + heap[0].hblkhd);
+
+    printf("alloc: %s, %d pixels, %d frames, arena %zu bytes%s%s\n", backend->name, pixels, opt->frames, leds.arena_len,
+           opt->is_locked ? ", locked" : "", opt->is_hugepages ? ", hugepages" : "");
+    printf("    heap in use change %ld bytes, %ld page faults: %s\n", heap_diff, faults, ((heap_diff == 0) && (faults == 0)) ? "OK" : "FAILED");
+
+    apa102_done(&leds);
+    free(argb);
+    free(index);
+
+    return ((heap_diff == 0) && (faults == 0)) ? 0 : -1;
+}
+
+
+static void present_count(void *arg, const apa102_presented_t *presented)
+{
+    uint64_t *counts = (uint64_t *)arg;
+
+    counts[presented->status] += 1;
+}
+
+
+/*
+ * Frame by frame, so the latency is the one of an idle pipeline: encoding,
+ * handoff, transfer (simulated with -s and the null backend). Context
+ * switches are the process' ones, renderer thread included.
+ */
+static int bench_present(const bench_options_t *opt)
+{
+    const apa102spi_backend_t *backend = apa102spi_find_backend(opt->backend);
+    apa102_config_t            config;
+    apa102_t                   leds;
+    apa102_histogram_t         latency = {0};
+    uint64_t                   counts[APA102_FRAME_FAILED + 1] = {0};
+    uint64_t                   in_finish = 0;
+    struct rusage              usage[2];
+    long                       switches;
+    int                        pixels  = opt->pixels;
+    int                        lost    = 0;
+    int                        frame;
+    int                        i;
+
+    if (backend == NULL)
+    {
+        fprintf(stderr, "Unknown backend %s\n", opt->backend);
+        return -1;
+    }
+
+    config = get_config(opt, backend, opt->device, pixels);
+    config.on_presented  = present_count;
+    config.presented_arg = counts;
+    if (apa102_init(&leds, &config) != 0)
+    {
+        fprintf(stderr, "Cannot init APA102 library!\n");
+        return -1;
+    }
+
+    latency.min_ns = UINT64_MAX;
+    getrusage(RUSAGE_SELF, &usage[0]);
+    for (frame = 0; frame < opt->frames; ++frame)
+    {
+        apa102_presented_t presented;
+        uint64_t           finish;
+        uint64_t           id;
+        int                f = opt->is_static ? 0 : frame;
+
+        apa102_begin_frame(&leds, false);
+        for (i = 0; i < pixels; ++i)
+        {
+            apa102_set_pixel(&leds, i, COL_ARGB(0xff, f, i, f + i), APA102_PIX_MODE_COPY);
+        }
+
+        finish = get_ns();
+        apa102_finish_frame_id(&leds, &id);
+        in_finish += get_ns() - finish;
+        if (apa102_wait_presented(&leds, id, 1000, &presented) != 0)
+        {
+            ++lost;
+            continue;
+        }
+
+        latency.count    += 1;
+        latency.total_ns += presented.present_ns - finish;
+        latency.min_ns    = (presented.present_ns - finish < latency.min_ns) ? presented.present_ns - finish : latency.min_ns;
+        latency.max_ns    = (presented.present_ns - finish > latency.max_ns) ? presented.present_ns - finish : latency.max_ns;
+    }
+    getrusage(RUSAGE_SELF, &usage[1]);
+    apa102_done(&leds);
+
+    switches = usage[1].ru_nvcsw - usage[0].ru_nvcsw + usage[1].ru_nivcsw - usage[0].ru_nivcsw;
+
+    if (latency.count == 0)
+        latency.min_ns = 0;
+    else
+        latency.avg_ns = latency.total_ns / latency.count;
+
+    printf("present: %s, %s, %d pixels, %d frames\n", backend->name, opt->present, pixels, opt->frames);
+    printf("    frames: %llu sent, %llu skipped, %llu dropped, %llu failed, %d not presented in time\n",
+           (unsigned long long)counts[APA102_FRAME_SENT], (unsigned long long)counts[APA102_FRAME_SKIPPED],
+           (unsigned long long)counts[APA102_FRAME_DROPPED], (unsigned long long)counts[APA102_FRAME_FAILED], lost);
+    printf("    finish to present min %8.1f  avg %8.1f  max %8.1f us\n", latency.min_ns / 1e3, latency.avg_ns / 1e3, latency.max_ns / 1e3);
+    printf("    %8.1f us/frame in apa102_finish_frame(), %6.2f context switches/frame\n", in_finish / 1e3 / opt->frames, (double)switches / opt->frames);
+
+    return (lost == 0) ? 0 : -1;
+}
+
+
+static int bench_direct(const bench_options_t *opt)
+{
+    bench_options_t threaded = *opt;
+    bench_options_t direct   = *opt;
+
+    threaded.present = "fifo";
+    direct.present   = "direct";
+
+    return bench_present(&threaded) | bench_present(&direct);
+}
+
+
+static void poll_paint(apa102_t *leds, int frame, int pixels)
+{
+    int i;
+
+    for (i = 0; i < pixels; ++i)
+    {
+        apa102_set_pixel(leds, i, COL_ARGB(0xff, frame, i, frame + i), APA102_PIX_MODE_COPY);
+    }
+    apa102_finish_frame(leds);
+}
+
+
+/*
+ * Timer tick wants a frame, taken at once if free, otherwise when the free
+ * frames' eventfd says so (the tick is late then). Nothing blocks.
+ */
+static int bench_poll(const bench_options_t *opt)
+{
+    const apa102spi_backend_t *backend = apa102spi_find_backend(opt->backend);
+    apa102_config_t            config;
+    apa102_t                   leds;
+    struct itimerspec          period  = {{0, 1000000000L / POLL_FPS}, {0, 1000000000L / POLL_FPS}};
+    struct epoll_event         ev;
+    int                        pixels  = opt->pixels;
+    int                        epfd;
+    int                        tfd;
+    int                        ticks   = 0;
+    int                        frames  = 0;
+    int                        late    = 0;
+    int                        missed  = 0;
+    int                        wakeups = 0;
+    uint64_t                   presented = 0;
+    bool                       is_wanted = false;
+
+    if (backend == NULL)
+    {
+        fprintf(stderr, "Unknown backend %s\n", opt->backend);
+        return -1;
+    }
+
+    config = get_config(opt, backend, opt->device, pixels);
+    config.is_eventfd = true;
+    if (apa102_init(&leds, &config) != 0)
+    {
+        fprintf(stderr, "Cannot init APA102 library!\n");
+        return -1;
+    }
+
+    epfd = epoll_create1(EPOLL_CLOEXEC);
+    tfd  = timerfd_create(CLOCK_MONOTONIC, TFD_NONBLOCK | TFD_CLOEXEC);
+    timerfd_settime(tfd, 0, &period, NULL);
+
+    ev.events = EPOLLIN; ev.data.fd = tfd;
+    epoll_ctl(epfd, EPOLL_CTL_ADD, tfd, &ev);
+    ev.events = EPOLLIN; ev.data.fd = apa102_get_presented_fd(&leds);
+    epoll_ctl(epfd, EPOLL_CTL_ADD, ev.data.fd, &ev);
+
+    while (ticks < opt->frames)
+    {
+        uint64_t count;
+
+        if (epoll_wait(epfd, &ev, 1, -1) != 1)
+            continue;
+        ++wakeups;
+
+        if (ev.data.fd == tfd)
+        {
+            if (read(tfd, &count, sizeof(count)) != sizeof(count))
+                continue;
+            ticks  += (int)count;
+            missed += is_wanted ? (int)count : (int)count - 1;
+
+            if (apa102_try_begin_frame(&leds, false, 0) == 0)
+            {
+                poll_paint(&leds, frames++, pixels);
+                continue;
+            }
+
+            /* Wait for the renderer to release a frame */
+            if (!is_wanted)
+            {
+                is_wanted = true;
+                ev.events = EPOLLIN; ev.data.fd = apa102_get_free_fd(&leds);
+                epoll_ctl(epfd, EPOLL_CTL_ADD, ev.data.fd, &ev);
+            }
+        }
+        else if (ev.data.fd == apa102_get_presented_fd(&leds))
+        {
+            if (read(ev.data.fd, &count, sizeof(count)) == sizeof(count))
+                presented += count;
+        }
+        else if (apa102_try_begin_frame(&leds, false, 0) == 0)
+        {
+            epoll_ctl(epfd, EPOLL_CTL_DEL, ev.data.fd, NULL);
+            is_wanted = false;
+            ++late;
+            poll_paint(&leds, frames++, pixels);
+        }
+    }
+    apa102_done(&leds);
+    close(tfd);
+    close(epfd);
+
+    printf("poll: %s, %s, %d pixels, %d Hz timer, %d ticks\n", backend->name, opt->present, pixels, POLL_FPS, ticks);
+    printf("    %d frames rendered (%d late, waited for a free one), %d ticks missed, %llu presented, %d wake-ups\n",
+           frames, late, missed, (unsigned long long)presented, wakeups);
+
+    return 0;
+}
+
+
+/*
+ * The module search and translation display_set_pixel() did per pixel
+ * before the lookup table, kept as the reference.
+ */
+static int wall_ref_led(const display_module_config_t *modules, int count, int x, int y)
+{
+    int offsets[MAX_CHAINS] = {0};
+    int i;
+
+    for (i = 0; i < count; ++i)
+    {
+        const display_module_config_t *m  = &modules[i];
+        int                            w  = m->size.width;
+        int                            h  = m->size.height;
+        int                            zx = x - m->position.x;
+        int                            zy = y - m->position.y;
+        int                            minor = 0;
+        int                            major = 0;
+
+        if ((zx < 0) || (zx >= w) || (zy < 0) || (zy >= h))
+        {
+            offsets[m->chain] += w * h;
+            continue;
+        }
+
+        switch (m->anchor)
+        {
+            case DISPLAY_ANCHOR_TOPLEFT:
+                minor = ((zy & 1) != 0) ? (w - 1 - zx) : zx;
+                major = zy * w;
+                break;
+
+            case DISPLAY_ANCHOR_BTMRIGHT:
+                minor = (((h - 1 - zy) & 1) == 0) ? (w - 1 - zx) : zx;
+                major = (h - 1 - zy) * w;
+                break;
+
+            case DISPLAY_ANCHOR_BTMLEFT:
+                minor = ((zx & 1) == 0) ? (h - 1 - zy) : zy;
+                major = zx * h;
+                break;
+
+            case DISPLAY_ANCHOR_TOPRIGHT:
+                minor = (((w - 1 - zx) & 1) != 0) ? (h - 1 - zy) : zy;
+                major = (w - 1 - zx) * h;
+                break;
+        }
+
+        return PIXMAP_ENTRY(m->chain, offsets[m->chain] + major + minor);
+    }
+
+    return -1;
+}
+
+
+static void wall_modules(display_module_config_t *modules, int chains)
+{
+    static const display_module_anchor_t anchors[] = {DISPLAY_ANCHOR_TOPLEFT, DISPLAY_ANCHOR_TOPRIGHT, DISPLAY_ANCHOR_BTMRIGHT, DISPLAY_ANCHOR_BTMLEFT};
+    int                                  i;
+
+    for (i = 0; i < WALL_MODULES; ++i)
+    {
+        modules[i].name       = "wall";
+        modules[i].anchor     = anchors[i % 4];
+        modules[i].position.x = (i % (WALL_WIDTH / WALL_MODULE)) * WALL_MODULE;
+        modules[i].position.y = (i / (WALL_WIDTH / WALL_MODULE)) * WALL_MODULE;
+        modules[i].size.width  = WALL_MODULE;
+        modules[i].size.height = WALL_MODULE;
+        modules[i].chain       = i % chains;
+    }
+}
+
+
+/*
+ * Image painted per pixel and blitted over the same background must give
+ * the same frame, clipped parts included.
+ */
+static int wall_blit_check(display_t *display, const uint32_t *image, int x, int y, int width, int height, apa102_pix_mode_t mode)
+{
+    uint32_t expected[WALL_WIDTH * WALL_HEIGHT];
+    uint32_t got[WALL_WIDTH * WALL_HEIGHT];
+    int      pass;
+    int      i;
+    int      j;
+
+    for (pass = 0; pass < 2; ++pass)
+    {
+        uint32_t *frame = (pass == 0) ? expected : got;
+
+        display_begin_frame(display, false);
+        for (i = 0; i < WALL_WIDTH * WALL_HEIGHT; ++i)
+        {
+            display_set_pixel(display, i % WALL_WIDTH, i / WALL_WIDTH, COL_ARGB(0xff, i, i * 3, i * 7), APA102_PIX_MODE_COPY);
+        }
+
+        if (pass == 0)
+        {
+            for (j = 0; j < height; ++j)
+            {
+                for (i = 0; i < width; ++i)
+                {
+                    display_set_pixel(display, x + i, y + j, image[j * WALL_WIDTH + i], mode);
+                }
+            }
+        }
+        else
+            display_blit(display, x, y, width, height, WALL_WIDTH, image, mode);
+
+        for (i = 0; i < WALL_WIDTH * WALL_HEIGHT; ++i)
+        {
+            display_get_pixel(display, i % WALL_WIDTH, i / WALL_WIDTH, &frame[i]);
+        }
+        display_finish_frame(display);
+    }
+
+    return (memcmp(expected, got, sizeof(got)) == 0) ? 0 : 1;
+}
+
+
+/*
+ * Wall's modules dealt to the chains, devices as in renderer mode.
+ */
+static int wall_init(const bench_options_t *opt, display_t *display, display_config_t *config, display_module_config_t *modules, display_chain_config_t *chains)
+{
+    char        devices[256];
+    const char *device = NULL;
+    int         c;
+
+    snprintf(devices, sizeof(devices), "%s", opt->device);
+    for (c = 0; c < opt->chains; ++c)
+    {
+        char *next = strtok((c == 0) ? devices : NULL, ",");
+
+        device               = (next != NULL) ? next : device;
+        chains[c].spi_device = device;
+        chains[c].spi_speed  = opt->speed;
+    }
+
+    wall_modules(modules, opt->chains);
+    memset(config, 0, sizeof(*config));
+    config->backend      = apa102spi_find_backend(opt->backend);
+    config->modules      = modules;
+    config->module_count = WALL_MODULES;
+    config->chains       = chains;
+    config->chain_count  = opt->chains;
+
+    if ((config->backend == NULL) || (display_init(display, config) != 0))
+    {
+        fprintf(stderr, "Cannot init display!\n");
+        return -1;
+    }
+
+    return 0;
+}
+
+
+static int bench_display(const bench_options_t *opt)
+{
+    display_module_config_t modules[WALL_MODULES];
+    display_chain_config_t  chains[MAX_CHAINS];
+    display_config_t        config;
+    display_t               display;
+    int                     count      = WALL_MODULES;
+    int                     mismatches = 0;
+    uint64_t                first_ns   = UINT64_MAX;
+    uint64_t                last_ns    = 0;
+    uint64_t                start;
+    uint64_t                sum        = 0;
+    double                  ref_ns;
+    double                  lut_ns;
+    double                  ref_map_ns;
+    double                  lut_map_ns;
+    double                  blit_ns;
+    uint32_t                image[WALL_WIDTH * WALL_HEIGHT];
+    int                     frame;
+    int                     c;
+    int                     x;
+    int                     y;
+
+    if (wall_init(opt, &display, &config, modules, chains) != 0)
+        return -1;
+
+    for (y = -1; y <= WALL_HEIGHT; ++y)
+    {
+        for (x = -1; x <= WALL_WIDTH; ++x)
+        {
+            if (display_get_led(&display, x, y) != wall_ref_led(modules, count, x, y))
+                ++mismatches;
+        }
+    }
+
+    for (x = 0; x < WALL_WIDTH * WALL_HEIGHT; ++x)
+    {
+        image[x] = ((uint32_t)rand() << 16) ^ (uint32_t)rand();
+    }
+    mismatches += wall_blit_check(&display, image, 0, 0, WALL_WIDTH, WALL_HEIGHT, APA102_PIX_MODE_COPY);
+    mismatches += wall_blit_check(&display, image, -7, 5, 40, 30, APA102_PIX_MODE_ADD);
+    mismatches += wall_blit_check(&display, image, 29, -3, 40, 13, APA102_PIX_MODE_XOR);
+    mismatches += wall_blit_check(&display, image, 3, 2, 9, 17, APA102_PIX_MODE_SUB);
+
+    /* Lookup alone, then with painting and sending */
+    start = get_ns();
+    for (frame = 0; frame < opt->frames; ++frame)
+    {
+        for (y = 0; y < WALL_HEIGHT; ++y)
+        {
+            for (x = 0; x < WALL_WIDTH; ++x)
+            {
+                sum += wall_ref_led(modules, count, x, y);
+            }
+        }
+    }
+    ref_map_ns = (double)(get_ns() - start) / opt->frames;
+
+    start = get_ns();
+    for (frame = 0; frame < opt->frames; ++frame)
+    {
+        for (y = 0; y < WALL_HEIGHT; ++y)
+        {
+            for (x = 0; x < WALL_WIDTH; ++x)
+            {
+                sum -= display_get_led(&display, x, y);
+            }
+        }
+    }
+    lut_map_ns = (double)(get_ns() - start) / opt->frames;
+
+    start = get_ns();
+    for (frame = 0; frame < opt->frames; ++frame)
+    {
+        display_begin_frame(&display, false);
+        for (y = 0; y < WALL_HEIGHT; ++y)
+        {
+            for (x = 0; x < WALL_WIDTH; ++x)
+            {
+                int led = wall_ref_led(modules, count, x, y);
+
+                apa102_set_pixel(display_get_chain(&display, PIXMAP_CHAIN(led)), PIXMAP_LED(led), COL_ARGB(0xff, frame, x, y), APA102_PIX_MODE_COPY);
+            }
+        }
+        display_finish_frame(&display);
+    }
+    ref_ns = (double)(get_ns() - start) / opt->frames;
+
+    start = get_ns();
+    for (frame = 0; frame < opt->frames; ++frame)
+    {
+        display_begin_frame(&display, false);
+        for (y = 0; y < WALL_HEIGHT; ++y)
+        {
+            for (x = 0; x < WALL_WIDTH; ++x)
+            {
+                display_set_pixel(&display, x, y, COL_ARGB(0xff, frame, x, y), APA102_PIX_MODE_COPY);
+            }
+        }
+        display_finish_frame(&display);
+    }
+    lut_ns = (double)(get_ns() - start) / opt->frames;
+
+    start = get_ns();
+    for (frame = 0; frame < opt->frames; ++frame)
+    {
+        display_begin_frame(&display, false);
+        display_blit(&display, 0, 0, WALL_WIDTH, WALL_HEIGHT, WALL_WIDTH, image, APA102_PIX_MODE_COPY);
+        display_finish_frame(&display);
+    }
+    blit_ns = (double)(get_ns() - start) / opt->frames;
+
+    /* The chains' renderers start each frame together, the transfers end as long as they take */
+    for (c = 0; c < display.chain_count; ++c)
+    {
+        apa102_presented_t presented = {0};
+
+        if (apa102_wait_presented(display_get_chain(&display, c), display_get_chain(&display, c)->frame_id, 1000, &presented) != 0)
+            ++mismatches;
+        first_ns = (presented.present_ns < first_ns) ? presented.present_ns : first_ns;
+        last_ns  = (presented.present_ns > last_ns)  ? presented.present_ns : last_ns;
+    }
+
+    display_done(&display);
+
+    printf("display: %dx%d wall, %d modules %dx%d, %d chain(s), %d frames%s\n", WALL_WIDTH, WALL_HEIGHT, count, WALL_MODULE, WALL_MODULE, opt->chains, opt->frames,
+           ((mismatches != 0) || (sum != 0)) ? ", MISMATCH" : "");
+    printf("    search    %8.1f us/frame lookup, %8.1f us/frame painted and sent\n", ref_map_ns / 1e3, ref_ns / 1e3);
+    printf("    lut       %8.1f us/frame lookup, %8.1f us/frame painted and sent\n", lut_map_ns / 1e3, lut_ns / 1e3);
+    printf("    blit                                %8.1f us/frame painted and sent\n", blit_ns / 1e3);
+    printf("    chains    %8.1f us skew of the last frame\n", (last_ns - first_ns) / 1e3);
+
+    return (mismatches == 0) ? 0 : -1;
+}
+
+
+/*
+ * Per pixel references of the drawing primitives.
+ */
+static void draw_ref_rect(display_t *display, int x, int y, int width, int height, uint32_t argb, apa102_pix_mode_t mode, bool is_filled)
+{
+    int i;
+    int j;
+
+    for (j = 0; j < height; ++j)
+    {
+        for (i = 0; i < width; ++i)
+        {
+            if (is_filled || (i == 0) || (j == 0) || (i == width - 1) || (j == height - 1))
+                display_set_pixel(display, x + i, y + j, argb, mode);
+        }
+    }
+}
+
+
+static void draw_ref_line(display_t *display, int x0, int y0, int x1, int y1, uint32_t argb, apa102_pix_mode_t mode)
+{
+    int dx  = abs(x1 - x0);
+    int dy  = -abs(y1 - y0);
+    int err = dx + dy;
+
+    while (1)
+    {
+        int e2 = 2 * err;
+
+        display_set_pixel(display, x0, y0, argb, mode);
+        if ((x0 == x1) && (y0 == y1))
+            break;
+        if (e2 >= dy)
+        {
+            err += dy;
+            x0  += (x1 > x0) ? 1 : -1;
+        }
+        if (e2 <= dx)
+        {
+            err += dx;
+            y0  += (y1 > y0) ? 1 : -1;
+        }
+    }
+}
+
+
+static bool is_in_disc(int64_t dx, int64_t dy, int64_t r)
+{
+    return dx * dx + dy * dy <= r * r + r;
+}
+
+
+/*
+ * Outline: the disc's pixels having a 4-neighbour outside.
+ */
+static void draw_ref_circle(display_t *display, int cx, int cy, int r, uint32_t argb, apa102_pix_mode_t mode)
+{
+    int64_t dx;
+    int64_t dy;
+
+    /* Only the wall's pixels, so large circles stay quick */
+    for (dy = -(int64_t)cy; dy < WALL_HEIGHT - (int64_t)cy; ++dy)
+    {
+        for (dx = -(int64_t)cx; dx < WALL_WIDTH - (int64_t)cx; ++dx)
+        {
+            if (   is_in_disc(dx, dy, r)
+                && (   !is_in_disc(dx - 1, dy, r) || !is_in_disc(dx + 1, dy, r)
+                    || !is_in_disc(dx, dy - 1, r) || !is_in_disc(dx, dy + 1, r)))
+                display_set_pixel(display, (int)(cx + dx), (int)(cy + dy), argb, mode);
+        }
+    }
+}
+
+
+/*
+ * Shapes of every kind, partly off the wall, overlapping.
+ */
+static void draw_scene(display_t *display, bool is_ref, apa102_pix_mode_t mode)
+{
+    static const int lines[][4] = {{-5, -3, 70, 40}, {63, 0, 0, 31}, {3, 20, 60, 17}, {40, -10, 42, 50}, {10, 10, 10, 10}, {50, 5, 20, 5}};
+    static const int circles[][3] = {{32, 16, 10}, {0, 0, 7}, {60, 30, 15}, {20, 8, 0}, {45, 12, 1}};
+    uint32_t         argb = COL_ARGB(0xff, 0x35, 0x9a, 0xc2);
+    int              i;
+
+    for (i = 0; i < (int)(sizeof(lines) / sizeof(lines[0])); ++i)
+    {
+        if (is_ref)
+            draw_ref_line(display, lines[i][0], lines[i][1], lines[i][2], lines[i][3], argb, mode);
+        else
+            display_line(display, lines[i][0], lines[i][1], lines[i][2], lines[i][3], argb, mode);
+    }
+
+    for (i = 0; i < (int)(sizeof(circles) / sizeof(circles[0])); ++i)
+    {
+        if (is_ref)
+            draw_ref_circle(display, circles[i][0], circles[i][1], circles[i][2], argb, mode);
+        else
+            display_circle(display, circles[i][0], circles[i][1], circles[i][2], argb, mode);
+    }
+
+    if (is_ref)
+    {
+        draw_ref_rect(display, -4, 3, 30, 12, argb, mode, true);
+        draw_ref_rect(display, 50, 20, 30, 30, argb, mode, true);
+        draw_ref_rect(display, 5, 5, 50, 22, argb, mode, false);
+        draw_ref_rect(display, -2, -2, 68, 36, argb, mode, false);
+        draw_ref_rect(display, 30, 2, 1, 9, argb, mode, false);
+        draw_ref_rect(display, 2, 29, 20, 1, argb, mode, false);
+        draw_ref_rect(display, 0, 12, 64, 1, argb, mode, true);
+        draw_ref_rect(display, 61, -3, 1, 40, argb, mode, true);
+    }
+    else
+    {
+        display_fill_rect(display, -4, 3, 30, 12, argb, mode);
+        display_fill_rect(display, 50, 20, 30, 30, argb, mode);
+        display_rect(display, 5, 5, 50, 22, argb, mode);
+        display_rect(display, -2, -2, 68, 36, argb, mode);
+        display_rect(display, 30, 2, 1, 9, argb, mode);
+        display_rect(display, 2, 29, 20, 1, argb, mode);
+        display_hline(display, 0, 12, 64, argb, mode);
+        display_vline(display, 61, -3, 40, argb, mode);
+    }
+
+}
+
+
+/*
+ * Shapes reaching far off the wall (checked only, the per pixel ones walk
+ * every point).
+ */
+static void draw_far(display_t *display, bool is_ref, apa102_pix_mode_t mode)
+{
+    static const int lines[][4] = {{0, 0, 1000000, 5}, {-300000, 2, 300001, 30}, {30, 500000, 33, -400000}, {-7, -900000, 55, 800000}};
+    static const int circles[][3] = {{32, 1000, 990}, {-500, 16, 530}, {200, 200, 20}, {32, 16, 100000}, {32, -50000, 50010}};
+    uint32_t         argb = COL_ARGB(0xff, 0xc2, 0x35, 0x9a);
+    int              i;
+
+    for (i = 0; i < (int)(sizeof(lines) / sizeof(lines[0])); ++i)
+    {
+        if (is_ref)
+            draw_ref_line(display, lines[i][0], lines[i][1], lines[i][2], lines[i][3], argb, mode);
+        else
+            display_line(display, lines[i][0], lines[i][1], lines[i][2], lines[i][3], argb, mode);
+    }
+
+    for (i = 0; i < (int)(sizeof(circles) / sizeof(circles[0])); ++i)
+    {
+        if (is_ref)
+            draw_ref_circle(display, circles[i][0], circles[i][1], circles[i][2], argb, mode);
+        else
+            display_circle(display, circles[i][0], circles[i][1], circles[i][2], argb, mode);
+    }
+
+    /* Coordinates at the int limits, too far to walk: their wall part is known */
+    if (is_ref)
+    {
+        draw_ref_rect(display, 0, 27, WALL_WIDTH, 1, argb, mode, true);
+        draw_ref_rect(display, 44, 0, 1, WALL_HEIGHT, argb, mode, true);
+        draw_ref_rect(display, 10, 0, 1, WALL_HEIGHT, argb, mode, true);
+        for (i = 0; i < WALL_HEIGHT; ++i)
+        {
+            display_set_pixel(display, i, i, argb, mode);
+        }
+    }
+    else
+    {
+        display_line(display, INT_MIN, 27, INT_MAX, 27, argb, mode);
+        display_line(display, 44, INT_MAX, 44, INT_MIN, argb, mode);
+        display_line(display, INT_MIN, INT_MIN, INT_MAX, INT_MAX, argb, mode);
+        display_circle(display, 10 - INT_MAX, 16, INT_MAX, argb, mode);
+        display_circle(display, 32, 16, INT_MAX, argb, mode);
+    }
+}
+
+
+static int draw_check(display_t *display, apa102_pix_mode_t mode)
+{
+    uint32_t expected[WALL_WIDTH * WALL_HEIGHT];
+    uint32_t got[WALL_WIDTH * WALL_HEIGHT];
+    int      pass;
+    int      i;
+
+    for (pass = 0; pass < 2; ++pass)
+    {
+        uint32_t *frame = (pass == 0) ? expected : got;
+
+        display_begin_frame(display, false);
+        for (i = 0; i < WALL_WIDTH * WALL_HEIGHT; ++i)
+        {
+            display_set_pixel(display, i % WALL_WIDTH, i / WALL_WIDTH, COL_ARGB(0xff, i, i * 3, i * 7), APA102_PIX_MODE_COPY);
+        }
+        draw_scene(display, pass == 0, mode);
+        draw_far(display, pass == 0, mode);
+
+        for (i = 0; i < WALL_WIDTH * WALL_HEIGHT; ++i)
+        {
+            display_get_pixel(display, i % WALL_WIDTH, i / WALL_WIDTH, &frame[i]);
+        }
+        display_finish_frame(display);
+    }
+
+    return (memcmp(expected, got, sizeof(got)) == 0) ? 0 : 1;
+}
+
+
+/*
+ * Nested rectangles as display_test draws them, per pixel or by display_rect().
+ */
+static void draw_nested(display_t *display, bool is_ref)
+{
+    int i;
+
+    for (i = 0; (2 * i < WALL_WIDTH - 2 * i) && (2 * i < WALL_HEIGHT - 2 * i); ++i)
+    {
+        uint32_t argb   = COL_ARGB(0xff, i * 40, 0xff - i * 20, i * 10);
+        int      width  = WALL_WIDTH - 4 * i;
+        int      height = WALL_HEIGHT - 4 * i;
+
+        if (is_ref)
+            draw_ref_rect(display, 2 * i, 2 * i, width, height, argb, APA102_PIX_MODE_COPY, false);
+        else
+            display_rect(display, 2 * i, 2 * i, width, height, argb, APA102_PIX_MODE_COPY);
+    }
+}
+
+
+static int bench_draw(const bench_options_t *opt)
+{
+    static const apa102_pix_mode_t modes[] = {APA102_PIX_MODE_COPY, APA102_PIX_MODE_ADD, APA102_PIX_MODE_SUB, APA102_PIX_MODE_XOR};
+    display_module_config_t        modules[WALL_MODULES];
+    display_chain_config_t         chains[MAX_CHAINS];
+    display_config_t               config;
+    display_t                      display;
+    int                            mismatches = 0;
+    double                         ns[2][2];
+    uint64_t                       start;
+    int                            pass;
+    int                            frame;
+    int                            i;
+
+    if (wall_init(opt, &display, &config, modules, chains) != 0)
+        return -1;
+
+    for (i = 0; i < (int)(sizeof(modes) / sizeof(modes[0])); ++i)
+    {
+        mismatches += draw_check(&display, modes[i]);
+    }
+
+    /* Drawing alone (frames just begun and finished), per pixel then native */
+    for (pass = 0; pass < 2; ++pass)
+    {
+        uint64_t nested = 0;
+        uint64_t scene  = 0;
+
+        for (frame = 0; frame < opt->frames; ++frame)
+        {
+            display_begin_frame(&display, false);
+            start   = get_ns();
+            draw_nested(&display, pass == 0);
+            nested += get_ns() - start;
+            start   = get_ns();
+            draw_scene(&display, pass == 0, APA102_PIX_MODE_ADD);
+            scene  += get_ns() - start;
+            display_finish_frame(&display);
+        }
+        ns[pass][0] = (double)nested / opt->frames;
+        ns[pass][1] = (double)scene / opt->frames;
+    }
+
+    display_done(&display);
+
+    printf("draw: %dx%d wall, %d modules %dx%d, %d chain(s), %d frames%s\n", WALL_WIDTH, WALL_HEIGHT, WALL_MODULES, WALL_MODULE, WALL_MODULE, opt->chains, opt->frames,
+           (mismatches != 0) ? ", MISMATCH" : "");
+    printf("    per pixel %8.2f us nested rects, %8.2f us shapes (add)\n", ns[0][0] / 1e3, ns[0][1] / 1e3);
+    printf("    native    %8.2f us nested rects, %8.2f us shapes (add)\n", ns[1][0] / 1e3, ns[1][1] / 1e3);
+
+    return (mismatches == 0) ? 0 : -1;
+}
+
+
+/*
+ * LED i goes along the anti-diagonals of a triangle, so no two neighbours in
+ * a row are neighbours in the chain.
+ */
+static void pixmap_position(int led, int *x, int *y)
+{
+    int diagonal = 0;
+
+    while (led > diagonal)
+    {
+        led -= diagonal + 1;
+        ++diagonal;
+    }
+
+    *x = led;
+    *y = diagonal - led;
+}
+
+
+static int pixmap_start(const bench_options_t *opt, display_t *display, display_config_t *config, double *init_ms)
+{
+    uint64_t start = get_ns();
+    int      ret;
+
+    memset(config, 0, sizeof(*config));
+    config->spi_device = opt->device;
+    config->spi_speed  = opt->speed;
+    config->backend    = apa102spi_find_backend(opt->backend);
+    config->pixel_map  = PIXMAP_FILE;
+    config->lut_cache  = PIXMAP_CACHE;
+
+    ret      = (config->backend != NULL) ? display_init(display, config) : -1;
+    *init_ms = (get_ns() - start) / 1e6;
+
+    return ret;
+}
+
+
+static int bench_pixmap(const bench_options_t *opt)
+{
+    display_config_t config;
+    display_t        display;
+    FILE            *f;
+    int32_t         *parsed;
+    size_t           lut_len;
+    double           parse_ms;
+    double           cache_ms;
+    bool             is_cached;
+    int              mismatches = 0;
+    int              i;
+
+    f = fopen(PIXMAP_FILE, "w");
+    if (f == NULL)
+    {
+        fprintf(stderr, "Cannot write %s\n", PIXMAP_FILE);
+        return -1;
+    }
+    fprintf(f, "# index x y\n");
+    for (i = 0; i < opt->pixels; ++i)
+    {
+        int x;
+        int y;
+
+        pixmap_position(i, &x, &y);
+        fprintf(f, "%d %d %d\n", i, x, y);
+    }
+    fclose(f);
+    unlink(PIXMAP_CACHE);
+
+    /* First start parses and writes the cache */
+    if (pixmap_start(opt, &display, &config, &parse_ms) != 0)
+    {
+        fprintf(stderr, "Cannot init display!\n");
+        return -1;
+    }
+    lut_len = (size_t)display.size.width * display.size.height * sizeof(int32_t);
+    parsed  = (int32_t *)malloc(lut_len);
+    memcpy(parsed, display.lut, lut_len);
+    display_done(&display);
+
+    /* Then it is just mapped */
+    if (pixmap_start(opt, &display, &config, &cache_ms) != 0)
+    {
+        fprintf(stderr, "Cannot init display from the cache!\n");
+        free(parsed);
+        return -1;
+    }
+    is_cached = display.pixmap.is_cached;
+
+    for (i = 0; i < opt->pixels; ++i)
+    {
+        int x;
+        int y;
+
+        pixmap_position(i, &x, &y);
+        if (display_get_led(&display, x, y) != i)
+            ++mismatches;
+    }
+    if (memcmp(parsed, display.lut, lut_len) != 0)
+        ++mismatches;
+
+    printf("pixmap: %d LEDs, %dx%d, %d row runs, cache %zu bytes%s\n", display.led_config.pixel_count, display.size.width, display.size.height,
+           display.row_runs[display.size.height], lut_len, ((mismatches != 0) || !is_cached) ? ", MISMATCH" : "");
+    printf("    parsed   %8.2f ms display_init()\n", parse_ms);
+    printf("    cached   %8.2f ms display_init()\n", cache_ms);
+
+    display_done(&display);
+    free(parsed);
+    unlink(PIXMAP_FILE);
+    unlink(PIXMAP_CACHE);
+
+    return ((mismatches == 0) && is_cached) ? 0 : -1;
+}
+
+
+/*****************************************************************************
+ * Public functions
+ ****************************************************************************/
+
+
+/*************************************************************************//**
+ * Main.
+ *
+ * Entry point.
+ *
+ ****************************************************************************/
+int main(int argc, char *argv[])
+{
+    bench_options_t opt =
+    {
+        .mode      = DEFAULT_MODE,
+        .backend   = DEFAULT_BACKEND,
+        .device    = DEFAULT_DEVICE,
+        .speed     = DEFAULT_SPEED,
+        .pixels    = DEFAULT_PIXELS,
+        .frames    = DEFAULT_FRAMES,
+        .chains    = DEFAULT_CHAINS,
+        .queue     = "locked",
+        .present   = "fifo",
+        .depth     = 0,
+        .keepalive = -1,
+        .is_static = false,
+        .is_prefix = false,
+        .width     = 0,
+        .is_canvas = false,
+        .encode    = "raw",
+        .dither_hz = -1,
+        .is_locked = false,
+        .is_hugepages = false,
+        .policy    = "other",
+        .priority  = 0,
+        .cpu_mask  = 0,
+        .is_mlockall = false,
+    };
+    int c;
+    int ret;
+
+    while ((c = getopt(argc, argv, "m:b:d:s:n:f:c:q:p:k:u:zxw:ve:t:lgr:y:a:Lh")) != -1)
+    {
+        switch (c)
+        {
+            case 'm': opt.mode      = optarg;       break;
+            case 'b': opt.backend   = optarg;       break;
+            case 'd': opt.device    = optarg;       break;
+            case 's': opt.speed     = atoi(optarg); break;
+            case 'n': opt.pixels    = atoi(optarg); break;
+            case 'f': opt.frames    = atoi(optarg); break;
+            case 'c': opt.chains    = atoi(optarg); break;
+            case 'q': opt.queue     = optarg;       break;
+            case 'p': opt.present   = optarg;       break;
+            case 'k': opt.depth     = atoi(optarg); break;
+            case 'u': opt.keepalive = atoi(optarg); break;
+            case 'z': opt.is_static = true;         break;
+            case 'x': opt.is_prefix = true;         break;
+            case 'w': opt.width     = atoi(optarg); break;
+            case 'v': opt.is_canvas = true;         break;
+            case 'e': opt.encode    = optarg;       break;
+            case 't': opt.dither_hz = atoi(optarg); break;
+            case 'l': opt.is_locked = true;         break;
+            case 'g': opt.is_hugepages = true;      break;
+            case 'r': opt.policy    = optarg;       break;
+            case 'y': opt.priority  = atoi(optarg); break;
+            case 'a': opt.cpu_mask  = strtoul(optarg, NULL, 0); break;
+            case 'L': opt.is_mlockall = true;       break;
+            default:
+                usage(argv[0]);
+                return 1;
+        }
+    }
+
+    if ((opt.chains < 1) || (opt.chains > MAX_CHAINS))
+    {
+        fprintf(stderr, "Chain count must be 1-%d\n", MAX_CHAINS);
+        return 1;
+    }
+
+    debug_init();
+    if (strcmp(opt.mode, "renderer") == 0)
+        ret = bench_renderer(&opt);
+    else if (strcmp(opt.mode, "chunk") == 0)
+        ret = bench_chunk(&opt);
+    else if (strcmp(opt.mode, "queue") == 0)
+        ret = bench_queue(&opt);
+    else if (strcmp(opt.mode, "span") == 0)
+        ret = bench_span(&opt);
+    else if (strcmp(opt.mode, "encode") == 0)
+        ret = bench_encode(&opt);
+    else if (strcmp(opt.mode, "dither") == 0)
+        ret = bench_dither(&opt);
+    else if (strcmp(opt.mode, "pace") == 0)
+        ret = bench_pace(&opt);
+    else if (strcmp(opt.mode, "alloc") == 0)
+        ret = bench_alloc(&opt);
+    else if (strcmp(opt.mode, "present") == 0)
+        ret = bench_present(&opt);
+    else if (strcmp(opt.mode, "direct") == 0)
+        ret = bench_direct(&opt);
+    else if (strcmp(opt.mode, "display") == 0)
+        ret = bench_display(&opt);
+    else if (strcmp(opt.mode, "draw") == 0)
+        ret = bench_draw(&opt);
+    else if (strcmp(opt.mode, "pixmap") == 0)
+        ret = bench_pixmap(&opt);
+    else if (strcmp(opt.mode, "poll") == 0)
+        ret = bench_poll(&opt);
+    else
+    {
+        usage(argv[0]);
+        ret = -1;
+    }
+    debug_done();
+
+    return (ret == 0) ? 0 : 1;
+}
+
+
+/*****************************************************************************
+ * End of file
+ ****************************************************************************/
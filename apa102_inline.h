@@ -0,0 +1,96 @@
+/*************************************************************************//**
+ * @file apa102_inline.h
+ *
+ *     APA102 hot path pixel access, inlined into the caller.
+ *
+ *   apa102_get_view() hands out the raw pixels of the frame being rendered,
+ * the setters below write them directly, no call into the library, no range
+ * check and no mode switch per pixel. So the effect loops might be inlined
+ * and vectorized by the compiler (even more with the static library built
+ * with LTO, see libapa102.a in the Makefile).
+ *
+ *   The view is valid between apa102_begin_frame() and apa102_finish_frame()
+ * only, the pixel offsets are not checked at all.
+ *
+ ****************************************************************************/
+#ifndef __APA102_INLINE_H__
+#define __APA102_INLINE_H__
+
+#include <stdint.h>
+#include "apa102.h"
+#include "apa102_pixel.h"
+
+
+/*****************************************************************************
+ * Public types
+ ****************************************************************************/
+
+
+/**
+ * Frame view (wire format pixels of the active frame)
+ */
+typedef struct apa102_view_tt
+{
+    uint8_t  *pixels;      /**< First pixel (brightness, B, G, R)     */
+    int       count;       /**< Number of pixels                      */
+    uint8_t   brightness;  /**< Global brightness (ADD only)          */
+} apa102_view_t;
+
+
+/*****************************************************************************
+ * Public prototypes
+ ****************************************************************************/
+int apa102_get_view(apa102_t *self, apa102_view_t *view);
+
+
+/*****************************************************************************
+ * Public functions
+ ****************************************************************************/
+
+
+/*************************************************************************//**
+ * Set pixel color (APA102_PIX_MODE_COPY), unchecked
+ *
+ * @param[in]    view     Frame view
+ * @param[in]    pixel    LED offset in the chain (0 .. count - 1)
+ * @param[in]    argb     Desired color
+ *
+ ****************************************************************************/
+static inline void apa102_view_copy(const apa102_view_t *view, int pixel, uint32_t argb)
+{
+    apa102_pixel_blend(view->pixels + pixel * 4, argb, APA102_PIX_MODE_COPY, view->brightness);
+}
+
+
+/*************************************************************************//**
+ * Add to pixel color (APA102_PIX_MODE_ADD), unchecked
+ *
+ * @param[in]    view     Frame view
+ * @param[in]    pixel    LED offset in the chain (0 .. count - 1)
+ * @param[in]    argb     Color to add
+ *
+ ****************************************************************************/
+static inline void apa102_view_add(const apa102_view_t *view, int pixel, uint32_t argb)
+{
+    apa102_pixel_blend(view->pixels + pixel * 4, argb, APA102_PIX_MODE_ADD, view->brightness);
+}
+
+
+/*************************************************************************//**
+ * Xor pixel color (APA102_PIX_MODE_XOR), unchecked
+ *
+ * @param[in]    view     Frame view
+ * @param[in]    pixel    LED offset in the chain (0 .. count - 1)
+ * @param[in]    argb     Color to xor
+ *
+ ****************************************************************************/
+static inline void apa102_view_xor(const apa102_view_t *view, int pixel, uint32_t argb)
+{
+    apa102_pixel_blend(view->pixels + pixel * 4, argb, APA102_PIX_MODE_XOR, view->brightness);
+}
+
+
+#endif
+/*****************************************************************************
+ * End of file
+ ****************************************************************************/
@@ -0,0 +1,147 @@
+/*************************************************************************//**
+ * @file apa102_pixel.h
+ *
+ *     Scalar pixel combination kernel on the wire format, the one copy used
+ *     by the library (blend.h) and by apa102_inline.h.
+ *
+ *   Not to be included directly. It is reached through the public inline
+ * header, so all its names carry the APA102_/apa102_pixel_ prefix.
+ *
+ ****************************************************************************/
+#ifndef __APA102_PIXEL_H__
+#define __APA102_PIXEL_H__
+
+#include <stdint.h>
+#include <stdbool.h>
+#include "colors.h"
+#include "apa102.h"
+
+
+/*****************************************************************************
+ * Public macros
+ ****************************************************************************/
+#define APA102_BRIGHT_MAX   31    /* own brightness of a pixel (alpha 0-31)  */
+#define APA102_BRIGHT_MASK  0x1f
+#define APA102_BRIGHT_RAW   0xe0  /* wire byte marker bits                   */
+#define APA102_BRIGHT_DEF   0x00  /* wire byte following the global one      */
+
+
+/*****************************************************************************
+ * Public functions
+ ****************************************************************************/
+
+
+/*************************************************************************//**
+ * Pick the brightness byte of a pixel
+ *
+ * Alpha above 31 makes the pixel follow the global brightness, the marker
+ * is resolved when the frame is sent.
+ *
+ * @param[in]    alpha    Desired brightness
+ *
+ * @return    brightness byte in the wire format
+ *
+ ****************************************************************************/
+static inline uint8_t apa102_pixel_bright(uint32_t alpha)
+{
+    return (alpha <= APA102_BRIGHT_MAX) ? (APA102_BRIGHT_RAW | alpha) : APA102_BRIGHT_DEF;
+}
+
+
+/*************************************************************************//**
+ * Add or subtract brightness
+ *
+ * Pixels following the global brightness stay so, otherwise the current
+ * global value is used for the one following it.
+ *
+ * @param[in]    old           Old brightness (0-31, above: global)
+ * @param[in]    alpha         Desired brightness (0-31, above: global)
+ * @param[in]    is_add        Add, subtract otherwise
+ * @param[in]    brightness    Global brightness
+ *
+ * @return    combined brightness (0-31), or -1 for global
+ *
+ ****************************************************************************/
+static inline int apa102_pixel_bright_mix(uint32_t old, uint32_t alpha, bool is_add, uint8_t brightness)
+{
+    int bright_old = (old <= APA102_BRIGHT_MAX)   ? (int)old   : (brightness & APA102_BRIGHT_MASK);
+    int bright_new = (alpha <= APA102_BRIGHT_MAX) ? (int)alpha : (brightness & APA102_BRIGHT_MASK);
+
+    if ((old > APA102_BRIGHT_MAX) && (alpha > APA102_BRIGHT_MAX))
+        return -1;
+
+    return is_add ? COL_ADD(bright_old, bright_new, APA102_BRIGHT_MAX) : COL_SUB(bright_old, bright_new, 1);
+}
+
+
+/*************************************************************************//**
+ * Combine one pixel
+ *
+ * Inline, so the callers with constant mode get the switch folded away.
+ * Subtraction is done in int, so it saturates instead of wrapping around.
+ *
+ * @param[in,out]    pix           Pixel in the wire format (brightness, B, G, R)
+ * @param[in]        argb          Color, alpha above 31 means global brightness
+ * @param[in]        mode          Combination mode
+ * @param[in]        brightness    Global brightness (ADD/SUB only)
+ *
+ ****************************************************************************/
+static inline void apa102_pixel_blend(uint8_t *pix, uint32_t argb, apa102_pix_mode_t mode, uint8_t brightness)
+{
+    bool     is_own = ((pix[0] & APA102_BRIGHT_RAW) == APA102_BRIGHT_RAW);
+    uint32_t old    = is_own ? (pix[0] & APA102_BRIGHT_MASK) : 0xff;
+    int      mix;
+
+    switch (mode)
+    {
+        case APA102_PIX_MODE_COPY:
+            pix[0] = apa102_pixel_bright(COL_ALP(argb));
+            pix[1] = COL_BLU(argb);
+            pix[2] = COL_GRN(argb);
+            pix[3] = COL_RED(argb);
+            break;
+
+        case APA102_PIX_MODE_ADD:
+            mix    = apa102_pixel_bright_mix(old, COL_ALP(argb), true, brightness);
+            pix[0] = (mix >= 0) ? (APA102_BRIGHT_RAW | mix) : APA102_BRIGHT_DEF;
+            pix[1] = COL_ADD(pix[1], COL_BLU(argb), 255);
+            pix[2] = COL_ADD(pix[2], COL_GRN(argb), 255);
+            pix[3] = COL_ADD(pix[3], COL_RED(argb), 255);
+            break;
+
+        case APA102_PIX_MODE_SUB:
+            mix    = apa102_pixel_bright_mix(old, COL_ALP(argb), false, brightness);
+            pix[0] = (mix >= 0) ? (APA102_BRIGHT_RAW | mix) : APA102_BRIGHT_DEF;
+            pix[1] = COL_SUB(pix[1], (int)COL_BLU(argb), 1);
+            pix[2] = COL_SUB(pix[2], (int)COL_GRN(argb), 1);
+            pix[3] = COL_SUB(pix[3], (int)COL_RED(argb), 1);
+            break;
+
+        case APA102_PIX_MODE_SUB2:
+            pix[0] = apa102_pixel_bright(COL_ALP(argb));
+            pix[1] = COL_SUB2(pix[1], (int)COL_BLU(argb), 1, 32);
+            pix[2] = COL_SUB2(pix[2], (int)COL_GRN(argb), 1, 32);
+            pix[3] = COL_SUB2(pix[3], (int)COL_RED(argb), 1, 32);
+            break;
+
+        case APA102_PIX_MODE_INV2:
+            pix[0] = apa102_pixel_bright(COL_ALP(argb));
+            pix[1] = COL_INV2(pix[1], COL_BLU(argb), 1);
+            pix[2] = COL_INV2(pix[2], COL_GRN(argb), 1);
+            pix[3] = COL_INV2(pix[3], COL_RED(argb), 1);
+            break;
+
+        case APA102_PIX_MODE_XOR:
+            pix[0] = apa102_pixel_bright(COL_ALP(argb));
+            pix[1] ^= COL_BLU(argb);
+            pix[2] ^= COL_GRN(argb);
+            pix[3] ^= COL_RED(argb);
+            break;
+    }
+}
+
+
+#endif
+/*****************************************************************************
+ * End of file
+ ****************************************************************************/
@@ -13,6 +13,7 @@
 #include <sys/time.h>
 #include "apa102.h"
 #include "larson.h"
+#include "pacer.h"
 #include "debug.h"
 
 
@@ -26,6 +27,8 @@
 //#define PIXEL_COUNT 124
 //#define PIXEL_COUNT 8
 #define BRIGHTNESS 2
+#define SPOT_FPS    200  /* test 11: one pixel step per frame */
+#define LARSON_FPS  100
 
 
 /*****************************************************************************
@@ -136,8 +139,13 @@ static uint32_t get_color(int pos)
 
 static void test11(void)
 {
-    int pos  = 0;
-    int spot = PIXEL_COUNT;
+    int      pos  = 0;
+    int      spot = PIXEL_COUNT;
+    pacer_t  pacer;
+    uint64_t frame_ns;
+
+    /* Every step is to be seen, so slipping rather than dropping */
+    pacer_init(&pacer, SPOT_FPS, PACER_POLICY_SLIP);
 
     is_running = true;
     while (is_running)
@@ -145,6 +153,7 @@ static void test11(void)
         uint32_t spot_col = get_color(spot - 1);
         int pix = 0;
 
+        pacer_wait(&pacer, &frame_ns);
         apa102_begin_frame(&leds, false);
         while (pix < PIXEL_COUNT)
         {
@@ -162,8 +171,6 @@ static void test11(void)
         }
         apa102_finish_frame(&leds);
 
-        usleep(5 * 1000);
-
         ++pos;
         if ((pos >= spot) || (pos >= PIXEL_COUNT))
         {
@@ -229,7 +236,9 @@ static void test2(void)
         };
         int      frame = 0;
         int      count = sizeof(larsons) / sizeof(larson_t);
-        uint64_t start;
+        pacer_t  pacer;
+        uint64_t start_ns;
+        uint64_t frame_ns;
         int      i;
 
         DEBUG_MSG(stdout, "Starting test 2...\n");
@@ -241,12 +250,15 @@ static void test2(void)
             larson_init(larsons + i, get_us());
         }
 
-        start = get_us();
+        /* Larsons move by the frame time, dropped frames do not slow them */
+        pacer_init(&pacer, LARSON_FPS, PACER_POLICY_DROP);
+        pacer_wait(&pacer, &start_ns);
+        frame_ns = start_ns;
         while (is_running)
         {
             apa102_begin_frame(&leds, false);
             {
-                uint64_t time = get_us() - start;
+                uint64_t time = (frame_ns - start_ns) / 1000;
 
                 for (i = 0; i < count; ++i)
                 {
@@ -257,6 +269,7 @@ static void test2(void)
             apa102_finish_frame(&leds);
 
             ++frame;
+            pacer_wait(&pacer, &frame_ns);
         }
 
         for (i = 0; i < count; ++i)
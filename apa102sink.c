@@ -0,0 +1,292 @@
+/*************************************************************************//**
+ * @file apa102sink.c
+ *
+ *     APA102 LED chain output sinks not needing the SPI hardware.
+ *
+ *   All of them behave like the SPIdev backend from the renderer's point of
+ * view, so the whole pipeline can be measured on any box:
+ *     - file: every frame is appended to the given file as is
+ *     - pipe: frames are written to a named pipe or UNIX stream socket, a
+ *             reader going away fails the update (-3) instead of raising
+ *             SIGPIPE
+ *     - null: frames are dropped, if speed is given, the transfer time of
+ *             the real bus is simulated (the call blocks accordingly)
+ *
+ ****************************************************************************/
+#include <stdio.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <string.h>
+#include <errno.h>
+#include <time.h>
+#include <signal.h>
+#include <pthread.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include "debug.h"
+#include "apa102sink.h"
+
+
+/*******************************************************************************
+ * Private macros
+ ******************************************************************************/
+#define NSEC_PER_SEC 1000000000ULL
+
+
+/*******************************************************************************
+ * Private prototypes
+ ******************************************************************************/
+static int file_open  (apa102spi_t *self, const char *device, uint32_t speed_hz);
+static int pipe_open  (apa102spi_t *self, const char *device, uint32_t speed_hz);
+static int fd_close   (apa102spi_t *self);
+static int fd_update  (apa102spi_t *self, const uint8_t *data, int length);
+static int null_open  (apa102spi_t *self, const char *device, uint32_t speed_hz);
+static int null_close (apa102spi_t *self);
+static int null_update(apa102spi_t *self, const uint8_t *data, int length);
+
+
+/*******************************************************************************
+ * Public variables
+ ******************************************************************************/
+const apa102spi_backend_t apa102sink_backend_file =
+{
+    .name   = "file",
+    .open   = file_open,
+    .close  = fd_close,
+    .update = fd_update,
+};
+
+const apa102spi_backend_t apa102sink_backend_pipe =
+{
+    .name   = "pipe",
+    .open   = pipe_open,
+    .close  = fd_close,
+    .update = fd_update,
+};
+
+const apa102spi_backend_t apa102sink_backend_null =
+{
+    .name   = "null",
+    .open   = null_open,
+    .close  = null_close,
+    .update = null_update,
+};
+
+
+/*******************************************************************************
+ * Private functions
+ ******************************************************************************/
+
+
+static uint64_t get_ns(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+
+    return ts.tv_sec * NSEC_PER_SEC + ts.tv_nsec;
+}
+
+
+static int file_open(apa102spi_t *self, const char *device, uint32_t speed_hz)
+{
+    self->fd = open(device, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+    if (self->fd < 0)
+    {
+        fprintf(stderr, "Cannot open sink file %s\n", device);
+        return -1;
+    }
+    self->is_socket = false;
+
+    return 0;
+}
+
+
+static int pipe_open(apa102spi_t *self, const char *device, uint32_t speed_hz)
+{
+    struct stat st;
+
+    if (stat(device, &st) != 0)
+    {
+        fprintf(stderr, "Cannot find sink pipe %s\n", device);
+        return -1;
+    }
+
+    if (S_ISSOCK(st.st_mode))
+    {
+        struct sockaddr_un addr = {.sun_family = AF_UNIX};
+
+        if (strlen(device) >= sizeof(addr.sun_path))
+        {
+            fprintf(stderr, "Sink socket name too long %s\n", device);
+            return -2;
+        }
+        strcpy(addr.sun_path, device);
+
+        self->fd = socket(AF_UNIX, SOCK_STREAM, 0);
+        if (   (self->fd < 0)
+            || (connect(self->fd, (struct sockaddr *)&addr, sizeof(addr)) != 0))
+        {
+            fprintf(stderr, "Cannot connect sink socket %s\n", device);
+            fd_close(self);
+            return -3;
+        }
+        self->is_socket = true;
+    }
+    else
+    {
+        /* Blocks until the reader appears */
+        self->fd = open(device, O_WRONLY);
+        if (self->fd < 0)
+        {
+            fprintf(stderr, "Cannot open sink pipe %s\n", device);
+            return -4;
+        }
+        self->is_socket = false;
+    }
+
+    return 0;
+}
+
+
+static int fd_close(apa102spi_t *self)
+{
+    if (self->fd >= 0)
+    {
+        close(self->fd);
+        self->fd = -1;
+    }
+
+    return 0;
+}
+
+
+/*
+ * Named pipe write with SIGPIPE blocked for the calling thread, a SIGPIPE
+ * raised by it is taken back (unless one was pending already), so the
+ * process is not killed and EPIPE tells the reader is gone.
+ */
+static ssize_t pipe_write(int fd, const uint8_t *data, int length)
+{
+    static const struct timespec no_wait = {0, 0};
+    sigset_t                     sigpipe;
+    sigset_t                     pending;
+    sigset_t                     old;
+    bool                         was_pending;
+    ssize_t                      ret;
+    int                          err;
+
+    sigemptyset(&sigpipe);
+    sigaddset(&sigpipe, SIGPIPE);
+    pthread_sigmask(SIG_BLOCK, &sigpipe, &old);
+
+    sigpending(&pending);
+    was_pending = sigismember(&pending, SIGPIPE);
+
+    ret = write(fd, data, length);
+    err = errno;
+
+    if ((ret < 0) && (err == EPIPE) && !was_pending)
+    {
+        while ((sigtimedwait(&sigpipe, NULL, &no_wait) < 0) && (errno == EINTR))
+            ;
+    }
+
+    pthread_sigmask(SIG_SETMASK, &old, NULL);
+    errno = err;
+
+    return ret;
+}
+
+
+static int fd_update(apa102spi_t *self, const uint8_t *data, int length)
+{
+    if ((data == NULL) || (length <= 0))
+    {
+        DEBUG_MSG(stderr, "Sink write failed (invalid data or length)\n");
+        return -1;
+    }
+
+    while (length > 0)
+    {
+        ssize_t ret;
+
+        if (self->is_socket)
+            ret = send(self->fd, data, length, MSG_NOSIGNAL);
+        else if (self->backend == &apa102sink_backend_pipe)
+            ret = pipe_write(self->fd, data, length);
+        else
+            ret = write(self->fd, data, length);
+
+        if (ret < 0)
+        {
+            if (errno == EINTR)
+                continue;
+
+            if (errno == EPIPE)
+            {
+                DEBUG_MSG(stderr, "Sink gone (reader closed)\n");
+                return -3;
+            }
+
+            DEBUG_FMT(stderr, "Sink write failed%s\n", (self->fd < 0) ? " (sink probably not open)" : "");
+            return -2;
+        }
+
+        data   += ret;
+        length -= ret;
+    }
+
+    return 0;
+}
+
+
+static int null_open(apa102spi_t *self, const char *device, uint32_t speed_hz)
+{
+    self->speed_hz = speed_hz;
+    self->busy_ns  = 0;
+
+    return 0;
+}
+
+
+static int null_close(apa102spi_t *self)
+{
+    return 0;
+}
+
+
+static int null_update(apa102spi_t *self, const uint8_t *data, int length)
+{
+    if ((data == NULL) || (length <= 0))
+    {
+        DEBUG_MSG(stderr, "Null transfer failed (invalid data or length)\n");
+        return -1;
+    }
+
+    if (self->speed_hz > 0)
+    {
+        uint64_t        now   = get_ns();
+        uint64_t        start = (self->busy_ns > now) ? self->busy_ns : now;
+        struct timespec ts;
+
+        /* Bus is busy for the whole transfer, the call returns when done */
+        self->busy_ns = start + (length * 8ULL * NSEC_PER_SEC) / self->speed_hz;
+
+        ts.tv_sec  = self->busy_ns / NSEC_PER_SEC;
+        ts.tv_nsec = self->busy_ns % NSEC_PER_SEC;
+        while (clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &ts, NULL) == EINTR)
+            ;
+    }
+
+    return 0;
+}
+
+
+/*******************************************************************************
+ * End of file
+ ******************************************************************************/
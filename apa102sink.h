@@ -0,0 +1,24 @@
+/*************************************************************************//**
+ * @file apa102sink.h
+ *
+ *     APA102 LED chain output sinks not needing the SPI hardware.
+ *
+ ****************************************************************************/
+#ifndef __APA102SINK_H__
+#define __APA102SINK_H__
+
+#include "apa102spi.h"
+
+
+/*****************************************************************************
+ * Public variables
+ ****************************************************************************/
+extern const apa102spi_backend_t apa102sink_backend_file;  /**< Raw frames appended to a file      */
+extern const apa102spi_backend_t apa102sink_backend_pipe;  /**< Named pipe or UNIX stream socket   */
+extern const apa102spi_backend_t apa102sink_backend_null;  /**< Discards data, simulates bus speed */
+
+
+#endif
+/*****************************************************************************
+ * End of file
+ ****************************************************************************/
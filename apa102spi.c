@@ -6,6 +6,7 @@
  ****************************************************************************/
 #include <stdio.h>
 #include <stdint.h>
+#include <stdlib.h>
 #include <string.h>
 #include <sys/ioctl.h>
 #include <linux/ioctl.h>
@@ -15,67 +16,126 @@
 #include <unistd.h>
 #include <linux/spi/spidev.h>
 #include "debug.h"
+#include "apa102sink.h"
+#include "apa102spi.h"
+
+
+/*******************************************************************************
+ * Private macros
+ ******************************************************************************/
+#define SPIDEV_BUFSIZ_PATH    "/sys/module/spidev/parameters/bufsiz"
+#define SPIDEV_BUFSIZ_DEFAULT 4096
+#define SPIDEV_XFER_ALIGN     128  /* kernel aligns each transfer in its buffer */
+#define SPIDEV_XFER_MAX       511  /* SPI_IOC_MESSAGE(n) size field limit       */
+#define ALIGN_UP(x, a)        ((((x) + (a) - 1) / (a)) * (a))
+
+
+/*******************************************************************************
+ * Private prototypes
+ ******************************************************************************/
+static int spidev_open  (apa102spi_t *self, const char *device, uint32_t speed_hz);
+static int spidev_close (apa102spi_t *self);
+static int spidev_update(apa102spi_t *self, const uint8_t *data, int length);
+
+
+/*******************************************************************************
+ * Public variables
+ ******************************************************************************/
+const apa102spi_backend_t apa102spi_backend_spidev =
+{
+    .name   = "spidev",
+    .open   = spidev_open,
+    .close  = spidev_close,
+    .update = spidev_update,
+};
 
 
 /*******************************************************************************
  * Private variables
  ******************************************************************************/
-static int spi_fd = -1;
-static uint32_t spi_speed_hz = 0;
+static const apa102spi_backend_t *const backends[] =
+{
+    &apa102spi_backend_spidev,
+    &apa102sink_backend_file,
+    &apa102sink_backend_pipe,
+    &apa102sink_backend_null,
+};
 
 
 /*******************************************************************************
- * Public functions
+ * Private functions
  ******************************************************************************/
 
 
+static int read_bufsiz(void)
+{
+    FILE *f      = fopen(SPIDEV_BUFSIZ_PATH, "r");
+    int   bufsiz = 0;
+
+    if (f != NULL)
+    {
+        if (fscanf(f, "%d", &bufsiz) != 1)
+            bufsiz = 0;
+        fclose(f);
+    }
+
+    return (bufsiz > 0) ? bufsiz : SPIDEV_BUFSIZ_DEFAULT;
+}
+
+
 /*************************************************************************//**
  * Open SPI device
  *
  * root access might be needed.
  *
- * @param[in]    device      SPIdev device name.
- * @param[in]    speed_hz    SPIdev device speed (might be very rough, current
- *                           kernel's module contains bug allowing only limited
- *                           subset of available speeds).
+ * @param[in,out]    self        Output context
+ * @param[in]        device      SPIdev device name.
+ * @param[in]        speed_hz    SPIdev device speed (might be very rough,
+ *                               current kernel's module contains bug allowing
+ *                               only limited subset of available speeds).
  *
  * @return    zero on success, nonzero otherwise
  *
  ****************************************************************************/
-int apa102spi_open(const char *device, uint32_t speed_hz)
+static int spidev_open(apa102spi_t *self, const char *device, uint32_t speed_hz)
 {
     uint32_t mode = SPI_CPOL | SPI_CPHA | SPI_NO_CS;
     uint8_t  bits = 8;
     int      ret  = -1;
 
-    spi_fd = open(device, O_WRONLY);
-    if (spi_fd < 0)
+    self->fd = open(device, O_WRONLY);
+    if (self->fd < 0)
     {
         fprintf(stderr, "Cannot open SPI device %s\n", device);
         return -1;
     }
 
-    ret = ioctl(spi_fd, SPI_IOC_WR_MODE32, &mode);
+    ret = ioctl(self->fd, SPI_IOC_WR_MODE32, &mode);
     if (ret == -1)
     {
         fprintf(stderr, "Cannot setup SPI device mode %08x\n", mode);
         return -2;
     }
 
-    ret = ioctl(spi_fd, SPI_IOC_WR_BITS_PER_WORD, &bits);
+    ret = ioctl(self->fd, SPI_IOC_WR_BITS_PER_WORD, &bits);
     if (ret == -1)
     {
         fprintf(stderr, "Cannot setup SPI device bit count %d\n", bits);
         return -3;
     }
 
-    ret = ioctl(spi_fd, SPI_IOC_WR_MAX_SPEED_HZ, &speed_hz);
+    ret = ioctl(self->fd, SPI_IOC_WR_MAX_SPEED_HZ, &speed_hz);
     if (ret == -1)
     {
         fprintf(stderr, "Cannot setup SPI device speed %2.3f\n", speed_hz / 1000000.0);
         return -4;
     }
-    spi_speed_hz = speed_hz;
+    self->speed_hz = speed_hz;
+
+    /* Whole message must fit the driver's buffer, frame is split to fit */
+    self->bufsiz = read_bufsiz();
+    apa102spi_set_chunk_len(self, 0);
+    DEBUG_FMT(stderr, "SPI buffer size %d\n", self->bufsiz);
 
     return 0;
 }
@@ -84,18 +144,24 @@ int apa102spi_open(const char *device, uint32_t speed_hz)
 /*************************************************************************//**
  * Close SPI device
  *
+ * @param[in,out]    self    Output context
+ *
  * @return    zero on success, nonzero otherwise
  *
  ****************************************************************************/
-int apa102spi_close(void)
+static int spidev_close(apa102spi_t *self)
 {
-    if (spi_fd >= 0)
+    if (self->fd >= 0)
     {
-        fsync(spi_fd);
-        close(spi_fd);
-        spi_fd = -1;
+        fsync(self->fd);
+        close(self->fd);
+        self->fd = -1;
     }
 
+    free(self->xfers);
+    self->xfers    = NULL;
+    self->xfer_cap = 0;
+
     return 0;
 }
 
@@ -110,16 +176,25 @@ int apa102spi_close(void)
  *    - at least N/2 bits of anything - clock latching compensation (each LED
  *      delays clock for half of cycle)
  *
- * @param[in]    data      Frame data
- * @param[in]    length    Frame data length
+ * The frame is split to transfers of chunk_len bytes. They are submitted in
+ * as few SPI_IOC_MESSAGE(n) calls as the driver allows (the whole message has
+ * to fit its bufsiz), so a frame bigger than bufsiz does not fail anymore and
+ * with bufsiz raised (spidev.bufsiz=...) it takes single syscall. The clock
+ * pauses between the calls do not matter to APA102.
+ *
+ * @param[in,out]    self      Output context
+ * @param[in]        data      Frame data
+ * @param[in]        length    Frame data length
  *
  * @return    zero on success, nonzero otherwise
  *
  ****************************************************************************/
-int apa102spi_update(const uint8_t *data, int length)
+static int spidev_update(apa102spi_t *self, const uint8_t *data, int length)
 {
-    struct spi_ioc_transfer tr  = {.delay_usecs = 0, .speed_hz = spi_speed_hz};
-    int                     ret = -1;
+    struct spi_ioc_transfer *tr;
+    int                      count;
+    int                      first;
+    int                      i;
 
     if ((data == NULL) || (length <= 0))
     {
@@ -127,23 +202,195 @@ int apa102spi_update(const uint8_t *data, int length)
         return -1;
     }
 
-    tr.tx_buf = (unsigned long)data;
-    tr.len    = length;
+    count = (length + self->chunk_len - 1) / self->chunk_len;
+    if (count > self->xfer_cap)
+    {
+        tr = (struct spi_ioc_transfer *)realloc(self->xfers, count * sizeof(struct spi_ioc_transfer));
+        if (tr == NULL)
+        {
+            DEBUG_MSG(stderr, "SPI transfer failed (out of memory)\n");
+            return -3;
+        }
+        self->xfers    = tr;
+        self->xfer_cap = count;
+    }
 
-    DEBUG_DMP(stdout, data, length, 0, "SPI Data Transfer", NULL);
+    tr = self->xfers;
+    memset(tr, 0, count * sizeof(struct spi_ioc_transfer));
+    for (i = 0; i < count; ++i)
+    {
+        int pos = i * self->chunk_len;
 
-    ret = ioctl(spi_fd, SPI_IOC_MESSAGE(1), &tr);
+        tr[i].tx_buf   = (unsigned long)(data + pos);
+        tr[i].len      = ((length - pos) < self->chunk_len) ? (length - pos) : self->chunk_len;
+        tr[i].speed_hz = self->speed_hz;
+    }
 
-    if (ret < 0)
+    DEBUG_DMP(stdout, data, length, 0, "SPI Data Transfer", NULL);
+
+    for (first = 0; first < count; )
     {
-        DEBUG_FMT(stderr, "SPI transfer failed%s\n", (spi_fd < 0) ? " (device probably not open)" : "");
-        return -2;
+        int used = 0;
+        int n    = 0;
+
+        while (   (first + n < count)
+               && (n < SPIDEV_XFER_MAX)
+               && ((n == 0) || (used + ALIGN_UP(tr[first + n].len, SPIDEV_XFER_ALIGN) <= self->bufsiz)))
+        {
+            used += ALIGN_UP(tr[first + n].len, SPIDEV_XFER_ALIGN);
+            ++n;
+        }
+
+        if (ioctl(self->fd, SPI_IOC_MESSAGE(n), tr + first) < 0)
+        {
+            DEBUG_FMT(stderr, "SPI transfer failed%s\n", (self->fd < 0) ? " (device probably not open)" : "");
+            return -2;
+        }
+        first += n;
     }
 
     return 0;
 }
 
 
+/*******************************************************************************
+ * Public functions
+ ******************************************************************************/
+
+
+/*************************************************************************//**
+ * Open the output
+ *
+ * Every context is independent, so several chains (e.g. spidev0.0, spidev0.1,
+ * spidev1.0) might be open at once.
+ *
+ * @param[out]    self        Output context
+ * @param[in]     backend     Output backend, NULL selects SPIdev.
+ * @param[in]     device      Device name, its meaning depends on the backend.
+ * @param[in]     speed_hz    Bus speed (simulated one for non-SPI backends).
+ *
+ * @return    zero on success, nonzero otherwise
+ *
+ ****************************************************************************/
+int apa102spi_open(apa102spi_t *self, const apa102spi_backend_t *backend, const char *device, uint32_t speed_hz)
+{
+    int ret;
+
+    self->backend   = (backend != NULL) ? backend : &apa102spi_backend_spidev;
+    self->fd        = -1;
+    self->speed_hz  = speed_hz;
+    self->is_socket = false;
+    self->busy_ns   = 0;
+    self->bufsiz    = 0;
+    self->chunk_len = 0;
+    self->xfers     = NULL;
+    self->xfer_cap  = 0;
+
+    DEBUG_FMT(stderr, "Opening %s backend on %s\n", self->backend->name, device);
+
+    ret = self->backend->open(self, device, speed_hz);
+    if (ret != 0)
+    {
+        self->backend->close(self);
+        self->backend = NULL;
+    }
+
+    return ret;
+}
+
+
+/*************************************************************************//**
+ * Close the output
+ *
+ * @param[in,out]    self    Output context
+ *
+ * @return    zero on success, nonzero otherwise
+ *
+ ****************************************************************************/
+int apa102spi_close(apa102spi_t *self)
+{
+    int ret = 0;
+
+    if (self->backend != NULL)
+    {
+        ret = self->backend->close(self);
+        self->backend = NULL;
+    }
+
+    return ret;
+}
+
+
+/*************************************************************************//**
+ * Send the whole frame through the opened backend
+ *
+ * @param[in,out]    self      Output context
+ * @param[in]        data      Frame data
+ * @param[in]        length    Frame data length
+ *
+ * @return    zero on success, nonzero otherwise
+ *
+ ****************************************************************************/
+int apa102spi_update(apa102spi_t *self, const uint8_t *data, int length)
+{
+    if (self->backend == NULL)
+    {
+        DEBUG_MSG(stderr, "Output not open\n");
+        return -1;
+    }
+
+    return self->backend->update(self, data, length);
+}
+
+
+/*************************************************************************//**
+ * Change the length of one SPI transfer
+ *
+ * Mostly for measurements, the default (detected bufsiz) is the best choice
+ * normally. The length is limited by the driver's buffer size.
+ *
+ * @param[in,out]    self         Output context
+ * @param[in]        chunk_len    Transfer length in bytes, 0 for default
+ *
+ * @return    transfer length really used
+ *
+ ****************************************************************************/
+int apa102spi_set_chunk_len(apa102spi_t *self, int chunk_len)
+{
+    int bufsiz = (self->bufsiz > 0) ? self->bufsiz : SPIDEV_BUFSIZ_DEFAULT;
+    int limit  = (bufsiz >= SPIDEV_XFER_ALIGN) ? (bufsiz / SPIDEV_XFER_ALIGN) * SPIDEV_XFER_ALIGN : bufsiz;
+
+    if ((chunk_len <= 0) || (chunk_len > limit))
+        chunk_len = limit;
+
+    self->chunk_len = chunk_len;
+
+    return chunk_len;
+}
+
+
+/*************************************************************************//**
+ * Look up the backend by its name
+ *
+ * @param[in]    name    Backend name ("spidev", "file", "pipe", "null")
+ *
+ * @return    backend on success, NULL otherwise
+ *
+ ****************************************************************************/
+const apa102spi_backend_t *apa102spi_find_backend(const char *name)
+{
+    int i;
+
+    for (i = 0; i < sizeof(backends) / sizeof(backends[0]); ++i)
+    {
+        if (strcmp(backends[i]->name, name) == 0)
+            return backends[i];
+    }
+
+    return NULL;
+}
+
+
 /*******************************************************************************
  * End of file
  ******************************************************************************/
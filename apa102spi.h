@@ -8,14 +8,67 @@
 #define __APA102SPI_H__
 
 #include <stdint.h>
+#include <stdbool.h>
+
+
+/*****************************************************************************
+ * Public types
+ ****************************************************************************/
+
+
+struct apa102spi_tt;
+struct spi_ioc_transfer;
+
+
+/**
+ * Output backend operations
+ *
+ * Every frame leaves the library through one of these, the SPIdev one is the
+ * default, others (see apa102sink.h) allow running without the real hardware.
+ */
+typedef struct apa102spi_backend_tt
+{
+    const char *name;                                                                /**< Backend name         */
+    int (*open)  (struct apa102spi_tt *self, const char *device, uint32_t speed_hz); /**< Open the output      */
+    int (*close) (struct apa102spi_tt *self);                                        /**< Close the output     */
+    int (*update)(struct apa102spi_tt *self, const uint8_t *data, int length);       /**< Send the whole frame */
+} apa102spi_backend_t;
+
+
+/**
+ * Output context
+ *
+ * One per LED chain, so any number of chains can be driven by one process.
+ */
+typedef struct apa102spi_tt
+{
+    const apa102spi_backend_t *backend;   /**< Backend in use                  */
+    int                        fd;        /**< Device, file, pipe or socket    */
+    uint32_t                   speed_hz;  /**< Bus speed (or simulated one)    */
+    bool                       is_socket; /**< Sink is a socket (pipe backend) */
+    uint64_t                   busy_ns;   /**< Simulated bus busy until (null) */
+    int                        bufsiz;    /**< SPIdev kernel buffer size       */
+    int                        chunk_len; /**< Max. length of one transfer     */
+    struct spi_ioc_transfer   *xfers;     /**< Transfers of one frame (SPIdev) */
+    int                        xfer_cap;  /**< Number of allocated transfers   */
+} apa102spi_t;
+
+
+/*****************************************************************************
+ * Public variables
+ ****************************************************************************/
+extern const apa102spi_backend_t apa102spi_backend_spidev;
 
 
 /*****************************************************************************
  * Public prototypes
  ****************************************************************************/
-int apa102spi_open(const char *device, int speed_hz);
-int apa102spi_close(void);
-int apa102spi_update(const uint8_t *data, int length);
+int apa102spi_open  (apa102spi_t *self, const apa102spi_backend_t *backend, const char *device, uint32_t speed_hz);
+int apa102spi_close (apa102spi_t *self);
+int apa102spi_update(apa102spi_t *self, const uint8_t *data, int length);
+int apa102spi_set_chunk_len(apa102spi_t *self, int chunk_len);
+
+const apa102spi_backend_t *apa102spi_find_backend(const char *name);
 
 
 #endif
@@ -0,0 +1,804 @@
+/*************************************************************************//**
+ * @file blend.c
+ *
+ *     Pixel combination kernels working directly on the wire format.
+ *
+ *   Each mode has its own loop, so neither the mode switch nor the range
+ * checks are repeated per pixel. COPY/XOR are plain 32 bit word loops the
+ * compiler vectorizes on its own, the saturating ADD/SUB are written with
+ * GCC vector extensions (16 bytes = 4 pixels per step), which map to SSE2 or
+ * NEON. The rest (and the tails) fall back to blend_pixel().
+ *
+ *   The blend16_* ones work on the optional canvas (16 bits per channel, one
+ * lane per wire byte, 2 pixels per vector), blend16_encode() turns it into
+ * the wire format.
+ *
+ *   Pixels painted with alpha above 31 follow the global brightness, they
+ * carry a marker instead (BRIGHT_DEF in the wire format, CANVAS_DEF in the
+ * canvas), resolved by the encoders or blend_resolve() when the frame goes
+ * out. So changing the global brightness does not touch any pixel.
+ *
+ ****************************************************************************/
+#include <stdint.h>
+#include <string.h>
+#include <math.h>
+#include "blend.h"
+
+
+/*****************************************************************************
+ * Private macros
+ ****************************************************************************/
+#define PIXEL_LEN  4
+#define VEC_PIXELS 4  /* pixels per vector */
+
+#if defined(__BYTE_ORDER__) && (__BYTE_ORDER__ == __ORDER_LITTLE_ENDIAN__)
+#define BLEND_VECTOR 1  /* wire word is (argb << 8) | brightness in memory */
+#else
+#define BLEND_VECTOR 0
+#endif
+
+
+/*****************************************************************************
+ * Private types
+ ****************************************************************************/
+typedef uint8_t  v16u8_t __attribute__((vector_size(16)));
+typedef uint32_t v4u32_t __attribute__((vector_size(16)));
+typedef uint8_t  v8u8_t  __attribute__((vector_size(8)));
+typedef uint16_t v8u16_t __attribute__((vector_size(16)));
+typedef uint32_t u32a_t  __attribute__((may_alias));
+
+
+/*****************************************************************************
+ * Private functions
+ ****************************************************************************/
+
+
+#if BLEND_VECTOR
+static inline uint32_t to_wire(uint32_t argb)
+{
+    uint32_t alpha = argb >> 24;
+
+    return (argb << 8) | ((alpha <= BRIGHT_MAX) ? (BRIGHT_RAW | alpha) : BRIGHT_DEF);
+}
+
+
+static inline v4u32_t to_wire_vec(const uint32_t *argb)
+{
+    const v4u32_t max  = {BRIGHT_MAX, BRIGHT_MAX, BRIGHT_MAX, BRIGHT_MAX};
+    const v4u32_t raw  = {BRIGHT_RAW, BRIGHT_RAW, BRIGHT_RAW, BRIGHT_RAW};
+    v4u32_t       src;
+    v4u32_t       alpha;
+    v4u32_t       is_own;
+
+    memcpy(&src, argb, sizeof(src));
+    alpha  = src >> 24;
+    is_own = (v4u32_t)(alpha <= max);
+
+    return (src << 8) | ((raw | alpha) & is_own);
+}
+
+
+/* Brightness bytes following the global one are replaced by it */
+static inline v16u8_t resolve_vec(v16u8_t wire, v16u8_t *is_own, uint8_t brightness)
+{
+    const v16u8_t mask = {BRIGHT_MASK, 255, 255, 255, BRIGHT_MASK, 255, 255, 255, BRIGHT_MASK, 255, 255, 255, BRIGHT_MASK, 255, 255, 255};
+    const v16u8_t raw  = {BRIGHT_RAW,  0,   0,   0,   BRIGHT_RAW,  0,   0,   0,   BRIGHT_RAW,  0,   0,   0,   BRIGHT_RAW,  0,   0,   0  };
+    const v16u8_t def  = {brightness,  0,   0,   0,   brightness,  0,   0,   0,   brightness,  0,   0,   0,   brightness,  0,   0,   0  };
+
+    *is_own = (v16u8_t)((wire & raw) == raw);  /* channel bytes always */
+
+    return (wire & mask & *is_own) | (def & ~*is_own);
+}
+
+
+static void span_copy(uint8_t *dst, const uint32_t *argb, int count)
+{
+    u32a_t *out = (u32a_t *)dst;
+    int     i;
+
+    for (i = 0; i < count; ++i)
+    {
+        out[i] = to_wire(argb[i]);
+    }
+}
+
+
+static void span_xor(uint8_t *dst, const uint32_t *argb, int count)
+{
+    u32a_t *out = (u32a_t *)dst;
+    int     i;
+
+    /* Colors are xor-ed, brightness replaced */
+    for (i = 0; i < count; ++i)
+    {
+        uint32_t wire = to_wire(argb[i]);
+
+        out[i] = ((out[i] ^ wire) & ~0xffu) | (wire & 0xffu);
+    }
+}
+
+
+static void span_add(uint8_t *dst, const uint32_t *argb, int count, uint8_t brightness)
+{
+    const v16u8_t cap  = {BRIGHT_MAX,  255, 255, 255, BRIGHT_MAX,  255, 255, 255, BRIGHT_MAX,  255, 255, 255, BRIGHT_MAX,  255, 255, 255};
+    const v16u8_t raw  = {BRIGHT_RAW,  0,   0,   0,   BRIGHT_RAW,  0,   0,   0,   BRIGHT_RAW,  0,   0,   0,   BRIGHT_RAW,  0,   0,   0  };
+    int           i;
+
+    for (i = 0; i + VEC_PIXELS <= count; i += VEC_PIXELS)
+    {
+        v16u8_t old;
+        v16u8_t old_own;
+        v16u8_t add_own;
+        v16u8_t add = resolve_vec((v16u8_t)to_wire_vec(argb + i), &add_own, brightness);
+        v16u8_t sum;
+        v16u8_t over;
+
+        memcpy(&old, dst + i * PIXEL_LEN, sizeof(old));
+        old  = resolve_vec(old, &old_own, brightness);
+        sum  = old + add;
+        sum |= (v16u8_t)(sum < old);       /* wrapped: 255 */
+        over = (v16u8_t)(sum > cap);       /* brightness above 31 */
+        sum  = (sum & ~over) | (cap & over);
+        sum  = (sum | raw) & (old_own | add_own);  /* both global: stays so */
+        memcpy(dst + i * PIXEL_LEN, &sum, sizeof(sum));
+    }
+
+    for (; i < count; ++i)
+    {
+        blend_pixel(dst + i * PIXEL_LEN, argb[i], APA102_PIX_MODE_ADD, brightness);
+    }
+}
+
+
+static void span_sub(uint8_t *dst, const uint32_t *argb, int count, uint8_t brightness)
+{
+    const v16u8_t one  = {1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1};
+    const v16u8_t raw  = {BRIGHT_RAW,  0,   0,   0,   BRIGHT_RAW,  0,   0,   0,   BRIGHT_RAW,  0,   0,   0,   BRIGHT_RAW,  0,   0,   0  };
+    int           i;
+
+    for (i = 0; i + VEC_PIXELS <= count; i += VEC_PIXELS)
+    {
+        v16u8_t old;
+        v16u8_t old_own;
+        v16u8_t sub_own;
+        v16u8_t sub = resolve_vec((v16u8_t)to_wire_vec(argb + i), &sub_own, brightness);
+        v16u8_t diff;
+
+        memcpy(&old, dst + i * PIXEL_LEN, sizeof(old));
+        old   = resolve_vec(old, &old_own, brightness);
+        diff  = (old - sub) & (v16u8_t)(old > sub);  /* wrapped: 0 */
+        diff |= one & (v16u8_t)(diff == 0);           /* at least 1, as COL_SUB() */
+        diff  = (diff | raw) & (old_own | sub_own);
+        memcpy(dst + i * PIXEL_LEN, &diff, sizeof(diff));
+    }
+
+    for (; i < count; ++i)
+    {
+        blend_pixel(dst + i * PIXEL_LEN, argb[i], APA102_PIX_MODE_SUB, brightness);
+    }
+}
+
+
+static inline v8u16_t to_canvas_vec(v16u8_t wire, int half)
+{
+    const v8u16_t mask = {BRIGHT_MASK, 255, 255, 255, BRIGHT_MASK, 255, 255, 255};
+    const v8u16_t raw  = {BRIGHT_RAW, 0, 0, 0, BRIGHT_RAW, 0, 0, 0};
+    const v8u16_t def  = {CANVAS_DEF, 0, 0, 0, CANVAS_DEF, 0, 0, 0};
+    const v8u16_t mul  = {1, CANVAS_ONE, CANVAS_ONE, CANVAS_ONE, 1, CANVAS_ONE, CANVAS_ONE, CANVAS_ONE};
+    v8u8_t        part;
+    v8u16_t       pix;
+    v8u16_t       is_own;
+
+    memcpy(&part, (uint8_t *)&wire + half * sizeof(part), sizeof(part));
+    pix    = __builtin_convertvector(part, v8u16_t);
+    is_own = (v8u16_t)((pix & raw) == raw);
+
+    return ((pix & mask & is_own) | (def & ~is_own)) * mul;
+}
+
+
+static inline v8u16_t blend16_vec(v8u16_t old, v8u16_t col, apa102_pix_mode_t mode, uint8_t brightness)
+{
+    const v8u16_t cap    = {BRIGHT_MAX, CANVAS_MAX, CANVAS_MAX, CANVAS_MAX, BRIGHT_MAX, CANVAS_MAX, CANVAS_MAX, CANVAS_MAX};
+    const v8u16_t min    = {1, CANVAS_ONE, CANVAS_ONE, CANVAS_ONE, 1, CANVAS_ONE, CANVAS_ONE, CANVAS_ONE};
+    const v8u16_t bright = {CANVAS_MAX, 0, 0, 0, CANVAS_MAX, 0, 0, 0};
+    const v8u16_t def    = {brightness, 0, 0, 0, brightness, 0, 0, 0};
+    const v8u16_t mark   = {CANVAS_DEF, 0, 0, 0, CANVAS_DEF, 0, 0, 0};
+    v8u16_t       old_def;
+    v8u16_t       col_def;
+    v8u16_t       res    = col;
+    v8u16_t       sel;
+
+    /* Brightness lanes following the global one (only those exceed the cap) */
+    old_def = (v8u16_t)(old > cap);
+    col_def = (v8u16_t)(col > cap);
+
+    switch (mode)
+    {
+        case APA102_PIX_MODE_ADD:
+            old  = (old & ~old_def) | (def & old_def);
+            col  = (col & ~col_def) | (def & col_def);
+            res  = old + col;
+            res |= (v8u16_t)(res < old);
+            sel  = (v8u16_t)(res > cap);
+            res  = (res & ~sel) | (cap & sel);
+            sel  = old_def & col_def;
+            res  = (res & ~sel) | (mark & sel);
+            break;
+
+        case APA102_PIX_MODE_SUB:
+            old  = (old & ~old_def) | (def & old_def);
+            col  = (col & ~col_def) | (def & col_def);
+            res  = (old - col) & (v8u16_t)(old > col);
+            sel  = (v8u16_t)(res < min);
+            res  = (res & ~sel) | (min & sel);
+            sel  = old_def & col_def;
+            res  = (res & ~sel) | (mark & sel);
+            break;
+
+        case APA102_PIX_MODE_XOR:
+            res  = ((old ^ col) & ~bright) | (col & bright);
+            break;
+
+        default:
+            break;
+    }
+
+    return res;
+}
+
+
+static inline void span16_vec(uint16_t *dst, const uint32_t *argb, int count, apa102_pix_mode_t mode, uint8_t brightness)
+{
+    int i;
+
+    for (i = 0; i + VEC_PIXELS <= count; i += VEC_PIXELS)
+    {
+        v16u8_t  wire = (v16u8_t)to_wire_vec(argb + i);
+        uint16_t *pix = dst + i * CANVAS_LANES;
+        v8u16_t  lo;
+        v8u16_t  hi;
+
+        memcpy(&lo, pix, sizeof(lo));
+        memcpy(&hi, pix + 8, sizeof(hi));
+        lo = blend16_vec(lo, to_canvas_vec(wire, 0), mode, brightness);
+        hi = blend16_vec(hi, to_canvas_vec(wire, 1), mode, brightness);
+        memcpy(pix, &lo, sizeof(lo));
+        memcpy(pix + 8, &hi, sizeof(hi));
+    }
+
+    for (; i < count; ++i)
+    {
+        blend16_pixel(dst + i * CANVAS_LANES, COL_TO16(argb[i]), mode, brightness);
+    }
+}
+#endif
+
+
+static inline void span_pixels(uint8_t *dst, const uint32_t *argb, int count, apa102_pix_mode_t mode, uint8_t brightness)
+{
+    int i;
+
+    for (i = 0; i < count; ++i)
+    {
+        blend_pixel(dst + i * PIXEL_LEN, argb[i], mode, brightness);
+    }
+}
+
+
+static inline void span16_pixels(uint16_t *dst, const uint32_t *argb, int count, apa102_pix_mode_t mode, uint8_t brightness)
+{
+    int i;
+
+    for (i = 0; i < count; ++i)
+    {
+        blend16_pixel(dst + i * CANVAS_LANES, COL_TO16(argb[i]), mode, brightness);
+    }
+}
+
+
+static inline int scatter16_pixels(uint16_t *dst, int pixel_count, const int *pixel, const uint32_t *argb, int count, apa102_pix_mode_t mode, uint8_t brightness, int *dirty)
+{
+    int ignored = 0;
+    int last    = *dirty;
+    int i;
+
+    for (i = 0; i < count; ++i)
+    {
+        int p = pixel[i];
+
+        if ((unsigned)p >= (unsigned)pixel_count)
+        {
+            ++ignored;
+            continue;
+        }
+
+        if (p > last)
+            last = p;
+
+        blend16_pixel(dst + p * CANVAS_LANES, COL_TO16(argb[i]), mode, brightness);
+    }
+
+    *dirty = last;
+
+    return ignored;
+}
+
+
+static inline int scatter_pixels(uint8_t *dst, int pixel_count, const int *pixel, const uint32_t *argb, int count, apa102_pix_mode_t mode, uint8_t brightness, int *dirty)
+{
+    int ignored = 0;
+    int last    = *dirty;
+    int i;
+
+    for (i = 0; i < count; ++i)
+    {
+        int p = pixel[i];
+
+        if ((unsigned)p >= (unsigned)pixel_count)
+        {
+            ++ignored;
+            continue;
+        }
+
+        if (p > last)
+            last = p;
+
+        blend_pixel(dst + p * PIXEL_LEN, argb[i], mode, brightness);
+    }
+
+    *dirty = last;
+
+    return ignored;
+}
+
+
+/*****************************************************************************
+ * Public functions
+ ****************************************************************************/
+
+
+/*************************************************************************//**
+ * Combine a run of consecutive pixels
+ *
+ * @param[in,out]    dst           First pixel in the wire format
+ * @param[in]        argb          Colors, one per pixel
+ * @param[in]        count         Number of pixels
+ * @param[in]        mode          Combination mode
+ * @param[in]        brightness    Global brightness (ADD/SUB only)
+ *
+ ****************************************************************************/
+void blend_span(uint8_t *dst, const uint32_t *argb, int count, apa102_pix_mode_t mode, uint8_t brightness)
+{
+    brightness &= BRIGHT_MASK;
+
+    switch (mode)
+    {
+#if BLEND_VECTOR
+        case APA102_PIX_MODE_COPY: span_copy(dst, argb, count);                                     break;
+        case APA102_PIX_MODE_ADD:  span_add (dst, argb, count, brightness);                         break;
+        case APA102_PIX_MODE_SUB:  span_sub (dst, argb, count, brightness);                         break;
+        case APA102_PIX_MODE_XOR:  span_xor (dst, argb, count);                                     break;
+#else
+        case APA102_PIX_MODE_COPY: span_pixels(dst, argb, count, APA102_PIX_MODE_COPY, brightness); break;
+        case APA102_PIX_MODE_ADD:  span_pixels(dst, argb, count, APA102_PIX_MODE_ADD,  brightness); break;
+        case APA102_PIX_MODE_SUB:  span_pixels(dst, argb, count, APA102_PIX_MODE_SUB,  brightness); break;
+        case APA102_PIX_MODE_XOR:  span_pixels(dst, argb, count, APA102_PIX_MODE_XOR,  brightness); break;
+#endif
+        case APA102_PIX_MODE_SUB2: span_pixels(dst, argb, count, APA102_PIX_MODE_SUB2, brightness); break;
+        case APA102_PIX_MODE_INV2: span_pixels(dst, argb, count, APA102_PIX_MODE_INV2, brightness); break;
+    }
+}
+
+
+/*************************************************************************//**
+ * Combine a batch of arbitrary pixels
+ *
+ * @param[in,out]    dst            First pixel of the chain in the wire format
+ * @param[in]        pixel_count    Number of pixels in the chain
+ * @param[in]        pixel          Pixel offsets
+ * @param[in]        argb           Colors, one per offset
+ * @param[in]        count          Number of offsets
+ * @param[in]        mode           Combination mode
+ * @param[in]        brightness     Global brightness (ADD/SUB only)
+ * @param[in,out]    dirty          Highest pixel changed so far, updated
+ *
+ * @return    number of offsets out of range (ignored)
+ *
+ ****************************************************************************/
+int blend_scatter(uint8_t *dst, int pixel_count, const int *pixel, const uint32_t *argb, int count, apa102_pix_mode_t mode, uint8_t brightness, int *dirty)
+{
+    const int n = pixel_count;
+
+    switch (mode)
+    {
+        case APA102_PIX_MODE_COPY: return scatter_pixels(dst, n, pixel, argb, count, APA102_PIX_MODE_COPY, brightness, dirty);
+        case APA102_PIX_MODE_ADD:  return scatter_pixels(dst, n, pixel, argb, count, APA102_PIX_MODE_ADD,  brightness, dirty);
+        case APA102_PIX_MODE_SUB:  return scatter_pixels(dst, n, pixel, argb, count, APA102_PIX_MODE_SUB,  brightness, dirty);
+        case APA102_PIX_MODE_SUB2: return scatter_pixels(dst, n, pixel, argb, count, APA102_PIX_MODE_SUB2, brightness, dirty);
+        case APA102_PIX_MODE_XOR:  return scatter_pixels(dst, n, pixel, argb, count, APA102_PIX_MODE_XOR,  brightness, dirty);
+        case APA102_PIX_MODE_INV2: return scatter_pixels(dst, n, pixel, argb, count, APA102_PIX_MODE_INV2, brightness, dirty);
+    }
+
+    return 0;
+}
+
+
+/*************************************************************************//**
+ * Set a run of pixels to one color
+ *
+ * @param[in,out]    dst           First pixel in the wire format
+ * @param[in]        argb          Color
+ * @param[in]        count         Number of pixels
+ * @param[in]        brightness    Global brightness (ADD/SUB only)
+ *
+ ****************************************************************************/
+void blend_fill(uint8_t *dst, uint32_t argb, int count, uint8_t brightness)
+{
+    uint8_t pix[PIXEL_LEN];
+    int     i;
+
+    blend_pixel(pix, argb, APA102_PIX_MODE_COPY, brightness);
+    for (i = 0; i < count; ++i)
+    {
+        memcpy(dst + i * PIXEL_LEN, pix, PIXEL_LEN);
+    }
+}
+
+
+/*************************************************************************//**
+ * Combine a run of consecutive canvas pixels
+ *
+ * @param[in,out]    dst           First canvas pixel
+ * @param[in]        argb          Colors (8 bit ones), one per pixel
+ * @param[in]        count         Number of pixels
+ * @param[in]        mode          Combination mode
+ * @param[in]        brightness    Global brightness (ADD/SUB only)
+ *
+ ****************************************************************************/
+void blend16_span(uint16_t *dst, const uint32_t *argb, int count, apa102_pix_mode_t mode, uint8_t brightness)
+{
+    brightness &= BRIGHT_MASK;
+
+    switch (mode)
+    {
+#if BLEND_VECTOR
+        case APA102_PIX_MODE_COPY: span16_vec   (dst, argb, count, APA102_PIX_MODE_COPY, brightness); break;
+        case APA102_PIX_MODE_ADD:  span16_vec   (dst, argb, count, APA102_PIX_MODE_ADD,  brightness); break;
+        case APA102_PIX_MODE_SUB:  span16_vec   (dst, argb, count, APA102_PIX_MODE_SUB,  brightness); break;
+        case APA102_PIX_MODE_XOR:  span16_vec   (dst, argb, count, APA102_PIX_MODE_XOR,  brightness); break;
+#else
+        case APA102_PIX_MODE_COPY: span16_pixels(dst, argb, count, APA102_PIX_MODE_COPY, brightness); break;
+        case APA102_PIX_MODE_ADD:  span16_pixels(dst, argb, count, APA102_PIX_MODE_ADD,  brightness); break;
+        case APA102_PIX_MODE_SUB:  span16_pixels(dst, argb, count, APA102_PIX_MODE_SUB,  brightness); break;
+        case APA102_PIX_MODE_XOR:  span16_pixels(dst, argb, count, APA102_PIX_MODE_XOR,  brightness); break;
+#endif
+        case APA102_PIX_MODE_SUB2: span16_pixels(dst, argb, count, APA102_PIX_MODE_SUB2, brightness); break;
+        case APA102_PIX_MODE_INV2: span16_pixels(dst, argb, count, APA102_PIX_MODE_INV2, brightness); break;
+    }
+}
+
+
+/*************************************************************************//**
+ * Combine a batch of arbitrary canvas pixels
+ *
+ * @param[in,out]    dst            First canvas pixel of the chain
+ * @param[in]        pixel_count    Number of pixels in the chain
+ * @param[in]        pixel          Pixel offsets
+ * @param[in]        argb           Colors (8 bit ones), one per offset
+ * @param[in]        count          Number of offsets
+ * @param[in]        mode           Combination mode
+ * @param[in]        brightness     Global brightness (ADD/SUB only)
+ * @param[in,out]    dirty          Highest pixel changed so far, updated
+ *
+ * @return    number of offsets out of range (ignored)
+ *
+ ****************************************************************************/
+int blend16_scatter(uint16_t *dst, int pixel_count, const int *pixel, const uint32_t *argb, int count, apa102_pix_mode_t mode, uint8_t brightness, int *dirty)
+{
+    const int n = pixel_count;
+
+    switch (mode)
+    {
+        case APA102_PIX_MODE_COPY: return scatter16_pixels(dst, n, pixel, argb, count, APA102_PIX_MODE_COPY, brightness, dirty);
+        case APA102_PIX_MODE_ADD:  return scatter16_pixels(dst, n, pixel, argb, count, APA102_PIX_MODE_ADD,  brightness, dirty);
+        case APA102_PIX_MODE_SUB:  return scatter16_pixels(dst, n, pixel, argb, count, APA102_PIX_MODE_SUB,  brightness, dirty);
+        case APA102_PIX_MODE_SUB2: return scatter16_pixels(dst, n, pixel, argb, count, APA102_PIX_MODE_SUB2, brightness, dirty);
+        case APA102_PIX_MODE_XOR:  return scatter16_pixels(dst, n, pixel, argb, count, APA102_PIX_MODE_XOR,  brightness, dirty);
+        case APA102_PIX_MODE_INV2: return scatter16_pixels(dst, n, pixel, argb, count, APA102_PIX_MODE_INV2, brightness, dirty);
+    }
+
+    return 0;
+}
+
+
+/*************************************************************************//**
+ * Set a run of canvas pixels to one color
+ *
+ * @param[in,out]    dst           First canvas pixel
+ * @param[in]        argb16        Color
+ * @param[in]        count         Number of pixels
+ * @param[in]        brightness    Global brightness (ADD/SUB only)
+ *
+ ****************************************************************************/
+void blend16_fill(uint16_t *dst, uint64_t argb16, int count, uint8_t brightness)
+{
+    uint16_t pix[CANVAS_LANES];
+    int      i;
+
+    blend16_pixel(pix, argb16, APA102_PIX_MODE_COPY, brightness);
+    for (i = 0; i < count; ++i)
+    {
+        memcpy(dst + i * CANVAS_LANES, pix, sizeof(pix));
+    }
+}
+
+
+/*************************************************************************//**
+ * Encode canvas pixels to the wire format
+ *
+ * Plain lane-wise loop, the compiler turns it into shifts, min and narrowing
+ * packs over several pixels at once.
+ *
+ * @param[out]    dst           First pixel in the wire format
+ * @param[in]     src           First canvas pixel
+ * @param[in]     count         Number of pixels
+ * @param[in]     brightness    Global brightness
+ *
+ ****************************************************************************/
+void blend16_encode(uint8_t *dst, const uint16_t *src, int count, uint8_t brightness)
+{
+    int i;
+
+    brightness &= BRIGHT_MASK;
+
+    for (i = 0; i < count * CANVAS_LANES; i += CANVAS_LANES)
+    {
+        dst[i + 0] = BRIGHT_RAW | ((src[i + 0] <= BRIGHT_MAX) ? src[i + 0] : brightness);
+        dst[i + 1] = src[i + 1] >> 8;
+        dst[i + 2] = src[i + 2] >> 8;
+        dst[i + 3] = src[i + 3] >> 8;
+    }
+}
+
+
+/*************************************************************************//**
+ * Copy pixels in the wire format, resolving the global brightness
+ *
+ * Pixels with their own brightness are copied as they are, the rest get the
+ * global one. A 32 bit word loop again, vectorized by the compiler.
+ *
+ * @param[out]    dst           First pixel to be sent
+ * @param[in]     src           First painted pixel
+ * @param[in]     count         Number of pixels
+ * @param[in]     brightness    Global brightness
+ *
+ ****************************************************************************/
+void blend_resolve(uint8_t *dst, const uint8_t *src, int count, uint8_t brightness)
+{
+    const u32a_t *in   = (const u32a_t *)src;
+    u32a_t       *out  = (u32a_t *)dst;
+    uint8_t       pix[PIXEL_LEN] = {BRIGHT_RAW, 0, 0, 0};
+    uint32_t      raw;
+    uint32_t      def;
+    int           i;
+
+    /* Byte 0 of the pixel in the native word order */
+    memcpy(&raw, pix, sizeof(raw));
+    pix[0] = BRIGHT_RAW | (brightness & BRIGHT_MASK);
+    memcpy(&def, pix, sizeof(def));
+
+    for (i = 0; i < count; ++i)
+    {
+        uint32_t word = in[i];
+
+        out[i] = ((word & raw) == raw) ? word : (word | def);
+    }
+}
+
+
+/*************************************************************************//**
+ * Prepare HDR encoder tables
+ *
+ * @param[out]    hdr      Tables
+ * @param[in]     gamma    Canvas to linear exponent (0: HDR_GAMMA_DEF)
+ *
+ ****************************************************************************/
+void blend_hdr_init(blend_hdr_t *hdr, double gamma)
+{
+    const int gamma_count  = 1 << HDR_GAMMA_BITS;
+    const int bright_count = 1 << HDR_BRIGHT_BITS;
+    const int bright_shift = 16 - HDR_BRIGHT_BITS;
+    int       i;
+
+    if (gamma <= 0.0)
+        gamma = HDR_GAMMA_DEF;
+
+    for (i = 0; i < gamma_count; ++i)
+    {
+        hdr->gamma[i] = (uint16_t)lround(pow((double)i / (gamma_count - 1), gamma) * CANVAS_MAX);
+    }
+
+    /* Rounded up to the top of the bucket, so the channels never overflow */
+    for (i = 0; i < bright_count; ++i)
+    {
+        int top    = (i << bright_shift) | ((1 << bright_shift) - 1);
+        int bright = (top * BRIGHT_MAX + CANVAS_MAX - 1) / CANVAS_MAX;
+
+        hdr->bright[i] = (bright < 1) ? 1 : bright;
+    }
+
+    hdr->recip[0] = 0;
+    hdr->scale[0] = 0;
+    for (i = 1; i <= BRIGHT_MAX; ++i)
+    {
+        hdr->recip[i] = (uint32_t)lround(65536.0 * BRIGHT_MAX * 255 / ((double)i * CANVAS_MAX));
+        hdr->scale[i] = (uint32_t)lround(65536.0 * i / BRIGHT_MAX);
+    }
+}
+
+
+/*************************************************************************//**
+ * Encode canvas pixels to the wire format using the global brightness field
+ *
+ * Just table lookups and multiplies per pixel. Dim colors get low global
+ * brightness and still most of the 8 bit channel range, so they do not band.
+ *
+ * @param[out]    dst           First pixel in the wire format
+ * @param[in]     src           First canvas pixel
+ * @param[in]     count         Number of pixels
+ * @param[in]     brightness    Global brightness
+ * @param[in]     hdr           Encoder tables
+ *
+ ****************************************************************************/
+void blend_hdr_encode(uint8_t *dst, const uint16_t *src, int count, uint8_t brightness, const blend_hdr_t *hdr)
+{
+    const int gamma_shift  = 16 - HDR_GAMMA_BITS;
+    const int bright_shift = 16 - HDR_BRIGHT_BITS;
+    int       i;
+
+    brightness &= BRIGHT_MASK;
+
+    for (i = 0; i < count * CANVAS_LANES; i += CANVAS_LANES)
+    {
+        uint32_t scale = hdr->scale[(src[i + 0] <= BRIGHT_MAX) ? src[i + 0] : brightness];
+        uint32_t blu   = (hdr->gamma[src[i + 1] >> gamma_shift] * scale) >> 16;
+        uint32_t grn   = (hdr->gamma[src[i + 2] >> gamma_shift] * scale) >> 16;
+        uint32_t red   = (hdr->gamma[src[i + 3] >> gamma_shift] * scale) >> 16;
+        uint32_t max   = (blu > grn) ? blu : grn;
+        uint32_t bright;
+        uint32_t recip;
+
+        max    = (red > max) ? red : max;
+        bright = hdr->bright[max >> bright_shift];
+        recip  = hdr->recip[bright];
+
+        dst[i + 0] = BRIGHT_RAW | bright;
+        dst[i + 1] = COL_ADD((blu * recip + 0x8000) >> 16, 0, 255);
+        dst[i + 2] = COL_ADD((grn * recip + 0x8000) >> 16, 0, 255);
+        dst[i + 3] = COL_ADD((red * recip + 0x8000) >> 16, 0, 255);
+    }
+}
+
+
+/*************************************************************************//**
+ * Encode canvas pixels to the wire format with temporal dithering
+ *
+ * The fraction cut off by the 8 bit channel is kept per channel and added to
+ * the next frame (first order sigma-delta), so the average over 256 frames
+ * reproduces the 16 bit value. Brightness is encoded as by blend16_encode().
+ *
+ * @param[out]       dst           First pixel in the wire format
+ * @param[in]        src           First canvas pixel
+ * @param[in,out]    err           Error accumulators, one per canvas lane
+ * @param[in]        count         Number of pixels
+ * @param[in]        brightness    Global brightness
+ *
+ ****************************************************************************/
+void blend16_dither(uint8_t *dst, const uint16_t *src, uint8_t *err, int count, uint8_t brightness)
+{
+    const v8u16_t bright = {CANVAS_MAX, 0, 0, 0, CANVAS_MAX, 0, 0, 0};
+    const v8u16_t max    = {BRIGHT_MAX, 255, 255, 255, BRIGHT_MAX, 255, 255, 255};
+    const v8u16_t raw    = {BRIGHT_RAW, 0, 0, 0, BRIGHT_RAW, 0, 0, 0};
+    const v8u16_t def    = {brightness & BRIGHT_MASK, 0, 0, 0, brightness & BRIGHT_MASK, 0, 0, 0};
+    int           i;
+
+    brightness &= BRIGHT_MASK;
+
+    /* Two pixels per step, all in 16 bit lanes: (hi + carry, lo) */
+    for (i = 0; i + 2 * CANVAS_LANES <= count * CANVAS_LANES; i += 2 * CANVAS_LANES)
+    {
+        v8u16_t col;
+        v8u8_t  part;
+        v8u16_t acc;
+        v8u16_t out;
+        v8u16_t sel;
+
+        memcpy(&col, src + i, sizeof(col));
+        memcpy(&part, err + i, sizeof(part));
+        acc = (col & 0xff) + __builtin_convertvector(part, v8u16_t);
+        out = (col >> 8) + (acc >> 8);
+        sel = (v8u16_t)(col > max) & bright;  /* global brightness */
+        out = (bright & ((col & ~sel) | (def & sel))) | (~bright & out);
+        sel = (v8u16_t)(out > max);
+        out = ((out & ~sel) | (max & sel)) | raw;
+        acc = acc & ~bright & 0xff;
+
+        part = __builtin_convertvector(out, v8u8_t);
+        memcpy(dst + i, &part, sizeof(part));
+        part = __builtin_convertvector(acc, v8u8_t);
+        memcpy(err + i, &part, sizeof(part));
+    }
+
+    for (; i < count * CANVAS_LANES; i += CANVAS_LANES)
+    {
+        uint32_t blu = src[i + 1] + err[i + 1];
+        uint32_t grn = src[i + 2] + err[i + 2];
+        uint32_t red = src[i + 3] + err[i + 3];
+
+        dst[i + 0] = BRIGHT_RAW | ((src[i + 0] <= BRIGHT_MAX) ? src[i + 0] : brightness);
+        dst[i + 1] = ((blu >> 8) < 255) ? (blu >> 8) : 255;
+        dst[i + 2] = ((grn >> 8) < 255) ? (grn >> 8) : 255;
+        dst[i + 3] = ((red >> 8) < 255) ? (red >> 8) : 255;
+        err[i + 1] = blu;
+        err[i + 2] = grn;
+        err[i + 3] = red;
+    }
+}
+
+
+/*************************************************************************//**
+ * HDR encode canvas pixels with temporal dithering
+ *
+ * As blend_hdr_encode(), the fraction of the scaled channel is carried to
+ * the next frame as by blend16_dither().
+ *
+ * @param[out]       dst           First pixel in the wire format
+ * @param[in]        src           First canvas pixel
+ * @param[in,out]    err           Error accumulators, one per canvas lane
+ * @param[in]        count         Number of pixels
+ * @param[in]        brightness    Global brightness
+ * @param[in]        hdr           Encoder tables
+ *
+ ****************************************************************************/
+void blend_hdr_dither(uint8_t *dst, const uint16_t *src, uint8_t *err, int count, uint8_t brightness, const blend_hdr_t *hdr)
+{
+    const int gamma_shift  = 16 - HDR_GAMMA_BITS;
+    const int bright_shift = 16 - HDR_BRIGHT_BITS;
+    int       i;
+
+    brightness &= BRIGHT_MASK;
+
+    for (i = 0; i < count * CANVAS_LANES; i += CANVAS_LANES)
+    {
+        uint32_t scale = hdr->scale[(src[i + 0] <= BRIGHT_MAX) ? src[i + 0] : brightness];
+        uint32_t blu   = (hdr->gamma[src[i + 1] >> gamma_shift] * scale) >> 16;
+        uint32_t grn   = (hdr->gamma[src[i + 2] >> gamma_shift] * scale) >> 16;
+        uint32_t red   = (hdr->gamma[src[i + 3] >> gamma_shift] * scale) >> 16;
+        uint32_t max   = (blu > grn) ? blu : grn;
+        uint32_t bright;
+        uint32_t recip;
+
+        max    = (red > max) ? red : max;
+        bright = hdr->bright[max >> bright_shift];
+        recip  = hdr->recip[bright];
+
+        /* 8.8 fixed point channels */
+        blu = ((blu * recip) >> 8) + err[i + 1];
+        grn = ((grn * recip) >> 8) + err[i + 2];
+        red = ((red * recip) >> 8) + err[i + 3];
+
+        dst[i + 0] = BRIGHT_RAW | bright;
+        dst[i + 1] = ((blu >> 8) < 255) ? (blu >> 8) : 255;
+        dst[i + 2] = ((grn >> 8) < 255) ? (grn >> 8) : 255;
+        dst[i + 3] = ((red >> 8) < 255) ? (red >> 8) : 255;
+        err[i + 1] = blu;
+        err[i + 2] = grn;
+        err[i + 3] = red;
+    }
+}
+
+
+/*****************************************************************************
+ * End of file
+ ****************************************************************************/
@@ -0,0 +1,187 @@
+/*************************************************************************//**
+ * @file blend.h
+ *
+ *     Pixel combination kernels working directly on the wire format
+ *     (library internal, the scalar kernel is shared with apa102_inline.h
+ *     through apa102_pixel.h).
+ *
+ ****************************************************************************/
+#ifndef __BLEND_H__
+#define __BLEND_H__
+
+#include <stdint.h>
+#include <stdbool.h>
+#include "colors.h"
+#include "apa102.h"
+#include "apa102_pixel.h"
+
+
+/*****************************************************************************
+ * Public macros
+ ****************************************************************************/
+#define BRIGHT_MAX  APA102_BRIGHT_MAX
+#define BRIGHT_MASK APA102_BRIGHT_MASK
+#define BRIGHT_RAW  APA102_BRIGHT_RAW
+#define BRIGHT_PICK(desired, def) (((desired) <= (BRIGHT_MAX)) ? (desired) : ((def) & BRIGHT_MASK))
+#define BRIGHT_DEF  APA102_BRIGHT_DEF  /* wire byte of a pixel following the global brightness */
+#define BRIGHT_IS_OWN(raw) (((raw) & BRIGHT_RAW) == BRIGHT_RAW)
+
+#define CANVAS_LANES 4      /* brightness, B, G, R, as in the wire format */
+#define CANVAS_ONE   257    /* one 8 bit step in the 16 bit channel       */
+#define CANVAS_MAX   0xffff
+#define CANVAS_DEF   0xff   /* brightness lane following the global one   */
+
+#define HDR_GAMMA_BITS  12  /* gamma table index: top bits of the channel */
+#define HDR_BRIGHT_BITS 11  /* brightness table index: top bits of the max */
+#define HDR_GAMMA_DEF   2.2
+
+
+/*****************************************************************************
+ * Public types
+ ****************************************************************************/
+
+
+/**
+ * HDR encoder tables
+ *
+ * The canvas channel goes through the gamma table to the linear light level,
+ * which is scaled by the pixel's brightness lane. Then the smallest global
+ * brightness able to show the brightest channel is picked and the channels
+ * are scaled to 8 bits for it. 31 x 255 levels give about 13 bits.
+ */
+typedef struct blend_hdr_tt
+{
+    uint16_t gamma [1 << HDR_GAMMA_BITS];   /**< Channel to linear level        */
+    uint8_t  bright[1 << HDR_BRIGHT_BITS];  /**< Linear max to global brightness */
+    uint32_t recip [BRIGHT_MAX + 1];        /**< Linear to 8 bit for brightness (16.16) */
+    uint32_t scale [BRIGHT_MAX + 1];        /**< Brightness lane to factor (16.16)      */
+} blend_hdr_t;
+
+
+/*****************************************************************************
+ * Public functions
+ ****************************************************************************/
+
+
+/*
+ * Pick the brightness byte of a pixel, see apa102_pixel_bright()
+ */
+static inline uint8_t blend_bright(uint32_t alpha)
+{
+    return apa102_pixel_bright(alpha);
+}
+
+
+/*
+ * Add or subtract brightness, see apa102_pixel_bright_mix()
+ */
+static inline int blend_bright_mix(uint32_t old, uint32_t alpha, bool is_add, uint8_t brightness)
+{
+    return apa102_pixel_bright_mix(old, alpha, is_add, brightness);
+}
+
+
+/*
+ * Combine one pixel, see apa102_pixel_blend()
+ */
+static inline void blend_pixel(uint8_t *pix, uint32_t argb, apa102_pix_mode_t mode, uint8_t brightness)
+{
+    apa102_pixel_blend(pix, argb, mode, brightness);
+}
+
+
+/*************************************************************************//**
+ * Combine one canvas pixel
+ *
+ * The same as blend_pixel(), just with 16 bit channels. The 8 bit limits are
+ * scaled by CANVAS_ONE, so 8 bit colors (COL_TO16()) give exactly the same
+ * result once encoded. Brightness lane above 31 follows the global one.
+ *
+ * @param[in,out]    pix           Canvas pixel (brightness, B, G, R)
+ * @param[in]        argb16        Color, alpha above 31 means global brightness
+ * @param[in]        mode          Combination mode
+ * @param[in]        brightness    Global brightness (ADD/SUB only)
+ *
+ ****************************************************************************/
+static inline void blend16_pixel(uint16_t *pix, uint64_t argb16, apa102_pix_mode_t mode, uint8_t brightness)
+{
+    uint32_t alpha  = COL16_ALP(argb16);
+    int      bright = (alpha <= BRIGHT_MAX) ? alpha : CANVAS_DEF;
+    int      blu    = COL16_BLU(argb16);
+    int      grn    = COL16_GRN(argb16);
+    int      red    = COL16_RED(argb16);
+    int      mix;
+
+    switch (mode)
+    {
+        case APA102_PIX_MODE_COPY:
+            pix[0] = bright;
+            pix[1] = blu;
+            pix[2] = grn;
+            pix[3] = red;
+            break;
+
+        case APA102_PIX_MODE_ADD:
+            mix    = blend_bright_mix(pix[0], alpha, true, brightness);
+            pix[0] = (mix >= 0) ? mix : CANVAS_DEF;
+            pix[1] = COL_ADD(pix[1], blu, CANVAS_MAX);
+            pix[2] = COL_ADD(pix[2], grn, CANVAS_MAX);
+            pix[3] = COL_ADD(pix[3], red, CANVAS_MAX);
+            break;
+
+        case APA102_PIX_MODE_SUB:
+            mix    = blend_bright_mix(pix[0], alpha, false, brightness);
+            pix[0] = (mix >= 0) ? mix : CANVAS_DEF;
+            pix[1] = COL_SUB(pix[1], blu, CANVAS_ONE);
+            pix[2] = COL_SUB(pix[2], grn, CANVAS_ONE);
+            pix[3] = COL_SUB(pix[3], red, CANVAS_ONE);
+            break;
+
+        case APA102_PIX_MODE_SUB2:
+            pix[0] = bright;
+            pix[1] = COL_SUB2(pix[1], blu, CANVAS_ONE, 32 * CANVAS_ONE);
+            pix[2] = COL_SUB2(pix[2], grn, CANVAS_ONE, 32 * CANVAS_ONE);
+            pix[3] = COL_SUB2(pix[3], red, CANVAS_ONE, 32 * CANVAS_ONE);
+            break;
+
+        case APA102_PIX_MODE_INV2:
+            pix[0] = bright;
+            pix[1] = (pix[1] > CANVAS_ONE) ? (CANVAS_MAX - pix[1]) : blu;
+            pix[2] = (pix[2] > CANVAS_ONE) ? (CANVAS_MAX - pix[2]) : grn;
+            pix[3] = (pix[3] > CANVAS_ONE) ? (CANVAS_MAX - pix[3]) : red;
+            break;
+
+        case APA102_PIX_MODE_XOR:
+            pix[0] = bright;
+            pix[1] ^= blu;
+            pix[2] ^= grn;
+            pix[3] ^= red;
+            break;
+    }
+}
+
+
+/*****************************************************************************
+ * Public prototypes
+ ****************************************************************************/
+void blend_span   (uint8_t *dst, const uint32_t *argb, int count, apa102_pix_mode_t mode, uint8_t brightness);
+int  blend_scatter(uint8_t *dst, int pixel_count, const int *pixel, const uint32_t *argb, int count, apa102_pix_mode_t mode, uint8_t brightness, int *dirty);
+void blend_fill   (uint8_t *dst, uint32_t argb, int count, uint8_t brightness);
+
+void blend16_span   (uint16_t *dst, const uint32_t *argb, int count, apa102_pix_mode_t mode, uint8_t brightness);
+int  blend16_scatter(uint16_t *dst, int pixel_count, const int *pixel, const uint32_t *argb, int count, apa102_pix_mode_t mode, uint8_t brightness, int *dirty);
+void blend16_fill   (uint16_t *dst, uint64_t argb16, int count, uint8_t brightness);
+void blend16_encode (uint8_t *dst, const uint16_t *src, int count, uint8_t brightness);
+void blend_resolve  (uint8_t *dst, const uint8_t *src, int count, uint8_t brightness);
+
+void blend_hdr_init (blend_hdr_t *hdr, double gamma);
+void blend_hdr_encode(uint8_t *dst, const uint16_t *src, int count, uint8_t brightness, const blend_hdr_t *hdr);
+
+void blend16_dither  (uint8_t *dst, const uint16_t *src, uint8_t *err, int count, uint8_t brightness);
+void blend_hdr_dither(uint8_t *dst, const uint16_t *src, uint8_t *err, int count, uint8_t brightness, const blend_hdr_t *hdr);
+
+
+#endif
+/*****************************************************************************
+ * End of file
+ ****************************************************************************/
@@ -24,6 +24,19 @@
                                        | (((uint32_t)(g)) <<  8) \
                                        | (((uint32_t)(b)) <<  0)))
 
+#define COL16_ALP(x) (0xffff & ((x) >> 48))
+#define COL16_RED(x) (0xffff & ((x) >> 32))
+#define COL16_GRN(x) (0xffff & ((x) >> 16))
+#define COL16_BLU(x) (0xffff & ((x) >>  0))
+
+#define COL_ARGB16(a, r, g, b) ((uint64_t)((((uint64_t)(a)) << 48) \
+                                         | (((uint64_t)(r)) << 32) \
+                                         | (((uint64_t)(g)) << 16) \
+                                         | (((uint64_t)(b)) <<  0)))
+
+/* 8 bit channels to 16 bit ones (x * 257, so 0xff is 0xffff), alpha kept */
+#define COL_TO16(x) COL_ARGB16(COL_ALP(x), COL_RED(x) * 257, COL_GRN(x) * 257, COL_BLU(x) * 257)
+
 #define COL_ADD(x, y, max) ((((x) + (y)) < (max)) ? ((x) + (y)) : (max))
 #define COL_SUB(x, y, min) ((((x) - (y)) > (min)) ? ((x) - (y)) : (min))
 #define COL_SUB2(x, y, min, trig) (((x) > (trig)) ? ((((x) - (y)) > (min)) ? ((x) - (y)) : (min)) : (y))
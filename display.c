@@ -32,20 +32,62 @@
  *     - size     (width, height) [5, 3]     [5, 3]
  *     - anchor                   top-left   bottom-left
  *
+ *     The translation is done once, display_init() compiles the modules into
+ * a lookup table of the LED index per (x, y) over the modules' bounding box
+ * (-1 where no module is), so a pixel access is a single load then. Each row
+ * is also split to runs, the consecutive columns having consecutive LEDs
+ * (forward or reversed by the zig-zag), so a row of the image goes to the
+ * chain by a few span calls. Columns of the modules chained vertically are
+ * not consecutive, they make scattered runs (LEDs taken from the table).
+ * The drawing primitives (lines, rectangles, circles) put their rows through
+ * the runs as well, in a solid color.
+ *
+ *     Layouts which are not rectangular zig-zag modules (rings, diagonal
+ * strips, irregular panels) are given by a pixel map file instead, see
+ * pixmap.c, which produces the same table (cached across the starts).
+ *
+ *     A big display might be split to several chains (module's chain, pixel
+ * map's chain column), each on its own SPI device with its own renderer
+ * thread, so the chains are transferred in parallel and the frame time is
+ * the one of the longest chain. The table holds PIXMAP_ENTRY() of the chain
+ * and the LED in it, a run never crosses chains. The frame is begun and
+ * finished on all the chains together, with more chains their renderers wait
+ * for each other before each transfer (barrier), so the chains show the same
+ * frame. Keeping the lockstep needs every chain's renderer to take every
+ * frame, i.e. the default FIFO presentation (the mailbox drops frames per
+ * chain); the direct mode sends the chains one after another.
+ *
  ****************************************************************************/
 
+#include <stdint.h>
+#include <string.h>
 #include <malloc.h>
+#include <pthread.h>
 #include "debug.h"
 #include "apa102.h"
 #include "display.h"
 
 
+/*****************************************************************************
+ * Private types
+ ****************************************************************************/
+
+
+struct display_chains_tt
+{
+    apa102_t          *leds[PIXMAP_MAX_CHAINS];  /**< Every chain, [0] is display_t.leds  */
+    apa102_config_t   *more_configs;             /**< Chains 1 .. chain_count - 1          */
+    apa102_t          *more_leds;
+    pthread_barrier_t  lockstep;                 /**< Renderers start frames together      */
+};
+
+
 /*****************************************************************************
  * Private functions
  ****************************************************************************/
 
 
-static int get_total_pixel_count(const display_module_config_t *modules, int count)
+static int get_chain_pixel_count(const display_module_config_t *modules, int count, int chain)
 {
     int i;
     int pixels = 0;
@@ -53,13 +95,30 @@ static int get_total_pixel_count(const display_module_config_t *modules, int cou
     for (i = 0; i < count; ++i)
     {
         const display_module_config_t *m = &modules[i];
-        pixels += m->size.width * m->size.height;
+
+        if (m->chain == chain)
+            pixels += m->size.width * m->size.height;
     }
 
     return pixels;
 }
 
 
+static int get_chain_count(const display_module_config_t *modules, int count)
+{
+    int i;
+    int chains = 1;
+
+    for (i = 0; i < count; ++i)
+    {
+        if (modules[i].chain + 1 > chains)
+            chains = modules[i].chain + 1;
+    }
+
+    return chains;
+}
+
+
 static bool is_module_hit(const display_module_config_t *module, int x, int y)
 {
     return x >= module->position.x 
@@ -141,7 +200,482 @@ static int get_led_offset(display_module_t *module, int x, int y)
         }
     }
 
-    return module->led_offset + major + minor;
+    return PIXMAP_ENTRY(module->config->chain, module->led_offset + major + minor);
+}
+
+
+static display_size_t get_display_size(const display_module_config_t *modules, int count)
+{
+    display_size_t size = {0, 0};
+    int            i;
+
+    for (i = 0; i < count; ++i)
+    {
+        const display_module_config_t *m = &modules[i];
+
+        if (m->position.x + m->size.width > size.width)
+            size.width = m->position.x + m->size.width;
+        if (m->position.y + m->size.height > size.height)
+            size.height = m->position.y + m->size.height;
+    }
+
+    return size;
+}
+
+
+/*
+ * The first module defined wins where they overlap, as the search did.
+ */
+static int32_t *create_lut(display_t *display)
+{
+    int32_t *lut = (int32_t *)malloc(display->size.width * display->size.height * sizeof(int32_t));
+    int      x;
+    int      y;
+
+    if (lut == NULL)
+        return NULL;
+
+    for (y = 0; y < display->size.height; ++y)
+    {
+        for (x = 0; x < display->size.width; ++x)
+        {
+            display_module_t *m = get_module_by_position(display->modules, x, y);
+
+            lut[y * display->size.width + x] = (m != NULL) ? get_led_offset(m, x, y) : -1;
+        }
+    }
+
+    return lut;
+}
+
+
+/*
+ * Runs of the row in the lookup table, returns their count (runs might be
+ * NULL to count them only). The entries are compared packed, so consecutive
+ * ones are in the same chain; scattered runs are split where the chain
+ * changes, their led is set by create_runs().
+ */
+static int get_row_runs(const int32_t *lut, int width, display_run_t *runs)
+{
+    int count = 0;
+    int x     = 0;
+
+    while (x < width)
+    {
+        display_run_t run = {.x = x, .count = 1, .chain = PIXMAP_CHAIN(lut[x]), .led = PIXMAP_LED(lut[x]), .step = 0};
+
+        if (lut[x] < 0)
+        {
+            ++x;
+            continue;
+        }
+
+        if ((x + 1 < width) && (lut[x + 1] >= 0) && ((lut[x + 1] - lut[x] == 1) || (lut[x + 1] - lut[x] == -1)))
+        {
+            run.step = lut[x + 1] - lut[x];
+            while ((x + run.count < width) && (lut[x + run.count] == lut[x] + run.step * run.count))
+                ++run.count;
+        }
+        else
+        {
+            /* Scattered until a hole, another chain or a consecutive pair starts */
+            while (   (x + run.count < width)
+                   && (lut[x + run.count] >= 0)
+                   && (PIXMAP_CHAIN(lut[x + run.count]) == run.chain)
+                   && (lut[x + run.count] - lut[x + run.count - 1] != 1)
+                   && (lut[x + run.count] - lut[x + run.count - 1] != -1))
+                ++run.count;
+        }
+
+        if (runs != NULL)
+            runs[count] = run;
+        ++count;
+        x += run.count;
+    }
+
+    return count;
+}
+
+
+static int create_runs(display_t *display)
+{
+    int total = 0;
+    int scattered;
+    int i;
+    int n;
+    int y;
+
+    display->row_runs = (int *)malloc((display->size.height + 1) * sizeof(int));
+    display->row_buf  = (uint32_t *)malloc((display->size.width + 1) * sizeof(uint32_t));
+    if ((display->row_runs == NULL) || (display->row_buf == NULL))
+        return -1;
+
+    for (y = 0; y < display->size.height; ++y)
+    {
+        display->row_runs[y] = total;
+        total += get_row_runs(display->lut + y * display->size.width, display->size.width, NULL);
+    }
+    display->row_runs[y] = total;
+
+    display->runs = (display_run_t *)malloc((total + 1) * sizeof(display_run_t));
+    if (display->runs == NULL)
+        return -1;
+
+    for (y = 0; y < display->size.height; ++y)
+    {
+        get_row_runs(display->lut + y * display->size.width, display->size.width, display->runs + display->row_runs[y]);
+    }
+
+    /* Scattered runs get their LEDs unpacked, as apa102_set_pixels() wants */
+    for (i = 0, scattered = 0; i < total; ++i)
+    {
+        scattered += (display->runs[i].step == 0) ? display->runs[i].count : 0;
+    }
+
+    display->scatter = (int *)malloc((scattered + 1) * sizeof(int));
+    if (display->scatter == NULL)
+        return -1;
+
+    for (y = 0, scattered = 0; y < display->size.height; ++y)
+    {
+        for (i = display->row_runs[y]; i < display->row_runs[y + 1]; ++i)
+        {
+            display_run_t *run = &display->runs[i];
+
+            if (run->step != 0)
+                continue;
+
+            for (n = 0; n < run->count; ++n)
+            {
+                display->scatter[scattered + n] = PIXMAP_LED(display->lut[y * display->size.width + run->x + n]);
+            }
+            run->led   = scattered;
+            scattered += run->count;
+        }
+    }
+
+    DEBUG_FMT(stderr, "Display %dx%d, %d row runs\n", display->size.width, display->size.height, total);
+
+    return 0;
+}
+
+
+static void delete_runs(display_t *display)
+{
+    free(display->runs);
+    free(display->row_runs);
+    free(display->row_buf);
+    free(display->scatter);
+    display->runs     = NULL;
+    display->row_runs = NULL;
+    display->row_buf  = NULL;
+    display->scatter  = NULL;
+}
+
+
+/*
+ * Columns x0 .. x1 - 1 of the row (already clipped to the display), argb[0]
+ * belongs to x0. A solid row (all the colors the same) needs no reversing.
+ */
+static void blit_row(display_t *display, int y, int x0, int x1, const uint32_t *argb, apa102_pix_mode_t mode, bool is_solid)
+{
+    const display_run_t *run  = display->runs + display->row_runs[y];
+    const display_run_t *last = display->runs + display->row_runs[y + 1];
+
+    for (; run < last; ++run)
+    {
+        apa102_t *leds = display->chains->leds[run->chain];
+        int       from = (run->x > x0) ? run->x : x0;
+        int       to   = (run->x + run->count < x1) ? run->x + run->count : x1;
+        int       led  = run->led + run->step * (from - run->x);
+        int       n    = to - from;
+        int       i;
+
+        if (n <= 0)
+        {
+            if (run->x >= x1)
+                break;
+            continue;
+        }
+
+        if ((run->step == 1) || ((run->step == -1) && is_solid))
+            apa102_set_span(leds, (run->step == 1) ? led : led - n + 1, n, argb + (from - x0), mode);
+        else if (run->step == -1)
+        {
+            /* LEDs go down with x, the span up */
+            for (i = 0; i < n; ++i)
+            {
+                display->row_buf[i] = argb[to - 1 - i - x0];
+            }
+            apa102_set_span(leds, led - n + 1, n, display->row_buf, mode);
+        }
+        else
+            apa102_set_pixels(leds, display->scatter + run->led + (from - run->x), argb + (from - x0), n, mode);
+    }
+}
+
+
+static bool is_pixmap(const display_config_t *config)
+{
+    return (config->pixel_map != NULL) || (config->lut_cache != NULL);
+}
+
+
+static int create_pixmap_lut(display_t *display)
+{
+    if (pixmap_load(&display->pixmap, display->config->pixel_map, display->config->lut_cache) != 0)
+    {
+        DEBUG_MSG(stderr, "Cannot load pixel map!\n");
+        return -1;
+    }
+
+    display->lut         = display->pixmap.lut;
+    display->size.width  = display->pixmap.width;
+    display->size.height = display->pixmap.height;
+    display->chain_count = (display->pixmap.chain_count > 0) ? display->pixmap.chain_count : 1;
+
+    return 0;
+}
+
+
+static void delete_lut(display_t *display)
+{
+    if (is_pixmap(display->config))
+        pixmap_free(&display->pixmap);
+    else
+        free(display->lut);
+
+    display->lut = NULL;
+}
+
+
+static int get_chain_pixels(display_t *display, int chain)
+{
+    if (is_pixmap(display->config))
+        return display->pixmap.chain_pixels[chain];
+
+    return get_chain_pixel_count(display->config->modules, display->config->module_count, chain);
+}
+
+
+/*
+ * Renderers' on_transfer, the chains start each frame together.
+ */
+static void sync_chains(void *arg)
+{
+    pthread_barrier_wait((pthread_barrier_t *)arg);
+}
+
+
+static void delete_chains(display_t *display, int initialized)
+{
+    display_chains_t *chains = display->chains;
+    int               c;
+
+    for (c = 0; c < initialized; ++c)
+    {
+        apa102_done(chains->leds[c]);
+    }
+    if (display->chain_count > 1)
+        pthread_barrier_destroy(&chains->lockstep);
+
+    free(chains->more_configs);
+    free(chains->more_leds);
+    free(chains);
+    display->chains = NULL;
+}
+
+
+/*
+ * Chain 0 lives in display_t (led_config, leds) as it did with one chain,
+ * the further ones are allocated.
+ */
+static int init_chains(display_t *display)
+{
+    const display_config_t *config = display->config;
+    display_chains_t       *chains;
+    int                     more   = display->chain_count - 1;
+    int                     c;
+
+    if (display->chain_count > ((config->chain_count > 0) ? config->chain_count : 1))
+    {
+        DEBUG_FMT(stderr, "Display uses %d chains, %d configured!\n", display->chain_count, config->chain_count);
+        return -1;
+    }
+
+    chains = (display_chains_t *)calloc(1, sizeof(display_chains_t));
+    if (chains == NULL)
+        return -1;
+
+    chains->more_configs = (apa102_config_t *)calloc(more + 1, sizeof(apa102_config_t));
+    chains->more_leds    = (apa102_t *)calloc(more + 1, sizeof(apa102_t));
+    if (   (chains->more_configs == NULL) || (chains->more_leds == NULL)
+        || ((more > 0) && (pthread_barrier_init(&chains->lockstep, NULL, display->chain_count) != 0)))
+    {
+        free(chains->more_configs);
+        free(chains->more_leds);
+        free(chains);
+        return -1;
+    }
+    display->chains = chains;
+
+    memset(&display->led_config, 0, sizeof(display->led_config));
+    for (c = 0; c < display->chain_count; ++c)
+    {
+        apa102_config_t *cfg = (c == 0) ? &display->led_config : &chains->more_configs[c - 1];
+
+        chains->leds[c]  = (c == 0) ? &display->leds : &chains->more_leds[c - 1];
+        cfg->spi_device  = (config->chain_count > 0) ? config->chains[c].spi_device : config->spi_device;
+        cfg->spi_speed   = (config->chain_count > 0) ? config->chains[c].spi_speed  : config->spi_speed;
+        cfg->backend     = config->backend;
+        cfg->pixel_count = get_chain_pixels(display, c);
+        cfg->brightness  = 0;
+
+        if (more > 0)
+        {
+            cfg->on_transfer  = sync_chains;
+            cfg->transfer_arg = &chains->lockstep;
+        }
+
+        DEBUG_FMT(stderr, "Initializing APA102 chain %d, %d LEDs...\n", c, cfg->pixel_count);
+        if (apa102_init(chains->leds[c], cfg) != 0)
+        {
+            delete_chains(display, c);
+            return -1;
+        }
+    }
+
+    return 0;
+}
+
+
+static int get_led(display_t *display, int x, int y)
+{
+    if (   (x < 0) || (x >= display->size.width)
+        || (y < 0) || (y >= display->size.height))
+        return -1;
+
+    return display->lut[y * display->size.width + x];
+}
+
+
+/*
+ * Row buffer holds the color for n columns, the solid rows go through it.
+ */
+static const uint32_t *get_solid_row(display_t *display, int n, uint32_t argb)
+{
+    int i;
+
+    for (i = 0; i < n; ++i)
+    {
+        display->row_buf[i] = argb;
+    }
+
+    return display->row_buf;
+}
+
+
+/*
+ * Columns x0 .. x1 of the row (inclusive, either order), clipped.
+ */
+static int solid_span(display_t *display, int y, int x0, int x1, uint32_t argb, apa102_pix_mode_t mode)
+{
+    int from = (x0 < x1) ? x0 : x1;
+    int to   = (x0 < x1) ? x1 : x0;
+
+    from = (from > 0) ? from : 0;
+    to   = (to < display->size.width - 1) ? to + 1 : display->size.width;
+
+    if ((y < 0) || (y >= display->size.height) || (from >= to))
+        return -1;
+
+    blit_row(display, y, from, to, get_solid_row(display, to - from, argb), mode, true);
+
+    return 0;
+}
+
+
+/*
+ * Rows y0 .. y1 - 1 of the column (already clipped to the display).
+ */
+static void solid_column(display_t *display, int x, int y0, int y1, uint32_t argb, apa102_pix_mode_t mode)
+{
+    const int32_t *lut = display->lut + y0 * display->size.width + x;
+    int            y;
+
+    for (y = y0; y < y1; ++y, lut += display->size.width)
+    {
+        if (*lut >= 0)
+            apa102_set_pixel(display->chains->leds[PIXMAP_CHAIN(*lut)], PIXMAP_LED(*lut), argb, mode);
+    }
+}
+
+
+/*
+ * Column of x (64 bits) brought to -1 .. width, where the spans still clip it.
+ */
+static int clamp_column(const display_t *display, int64_t x)
+{
+    if (x < -1)
+        return -1;
+    if (x > display->size.width)
+        return display->size.width;
+
+    return (int)x;
+}
+
+
+/*
+ * Circle row, columns inner .. half from the center on both sides, clipped.
+ */
+static int circle_row(display_t *display, int cx, int64_t y, int64_t inner, int64_t half, uint32_t argb, apa102_pix_mode_t mode)
+{
+    int ret;
+
+    if ((y < 0) || (y >= display->size.height))
+        return -1;
+
+    if (inner == 0)
+        return solid_span(display, y, clamp_column(display, cx - half), clamp_column(display, cx + half), argb, mode);
+
+    ret  = solid_span(display, y, clamp_column(display, cx - half), clamp_column(display, cx - inner), argb, mode);
+    ret &= solid_span(display, y, clamp_column(display, cx + inner), clamp_column(display, cx + half), argb, mode);
+
+    return ret;
+}
+
+
+/*
+ * Integer square root, floor(sqrt(n)) for n >= 0 (Newton).
+ */
+static int64_t isqrt64(int64_t n)
+{
+    int64_t x = n;
+    int64_t y = (n + 1) / 2;
+
+    while (y < x)
+    {
+        x = y;
+        y = (x + n / x) / 2;
+    }
+
+    return x;
+}
+
+
+/*
+ * Steps first .. last (of 0 .. count) going from start by step (+/-1) which
+ * land on 0 .. size - 1. Returns false when there are none.
+ */
+static bool get_line_steps(int start, int step, int64_t count, int size, int64_t *first, int64_t *last)
+{
+    int64_t lo = (step > 0) ? -(int64_t)start : (int64_t)start - (size - 1);
+    int64_t hi = (step > 0) ? (int64_t)size - 1 - start : (int64_t)start;
+
+    *first = (lo > 0) ? lo : 0;
+    *last  = (hi < count) ? hi : count;
+
+    return *first <= *last;
 }
 
 
@@ -153,16 +687,12 @@ static int get_led_offset(display_module_t *module, int x, int y)
 int display_init(display_t *display, const display_config_t *config)
 {
     int               i;
-    int               offset = 0;
-    int               mcnt   = config->module_count;
-    display_module_t *prev   = NULL;
+    int               offsets[PIXMAP_MAX_CHAINS] = {0};
+    int               mcnt = config->module_count;
+    display_module_t *prev = NULL;
 
     DEBUG_MSG(stderr, "Initializing display...\n");
-    display->config                 = config;
-    display->led_config.spi_device  = display->config->spi_device;
-    display->led_config.spi_speed   = display->config->spi_speed;
-    display->led_config.pixel_count = get_total_pixel_count(display->config->modules, display->config->module_count);
-    display->led_config.brightness  = 0;
+    display->config = config;
 
     DEBUG_MSG(stderr, "Initializing modules...\n");
     display->modules = (display_module_t *)malloc(mcnt * sizeof(display_module_t));
@@ -172,27 +702,72 @@ int display_init(display_t *display, const display_config_t *config)
         const display_module_config_t *mcfg = &config->modules[i];
         display_module_t              *m    = &display->modules[i];
 
+        if ((mcfg->chain < 0) || (mcfg->chain >= PIXMAP_MAX_CHAINS))
+        {
+            DEBUG_FMT(stderr, "Module %s: no chain %d!\n", mcfg->name, mcfg->chain);
+            free(display->modules);
+            return -1;
+        }
+
         m->config = mcfg;
         m->next = NULL;
 
         if (prev != NULL)
-        {
-            offset += prev->config->size.width * prev->config->size.height;
             prev->next = m;
-        }
 
-        m->led_offset = offset;
+        /* Modules are chained in the order they are defined, per chain */
+        m->led_offset = offsets[mcfg->chain];
+        offsets[mcfg->chain] += mcfg->size.width * mcfg->size.height;
         prev = m;
     }
 
+    DEBUG_MSG(stderr, "Compiling LED lookup table...\n");
+    display->runs     = NULL;
+    display->row_runs = NULL;
+    display->row_buf  = NULL;
+    display->scatter  = NULL;
+    memset(&display->pixmap, 0, sizeof(display->pixmap));
+    if (is_pixmap(config))
+    {
+        if (create_pixmap_lut(display) != 0)
+        {
+            free(display->modules);
+            return -1;
+        }
+    }
+    else
+    {
+        display->size        = get_display_size(config->modules, mcnt);
+        display->lut         = create_lut(display);
+        display->chain_count = get_chain_count(config->modules, mcnt);
+    }
+
+    if ((display->lut == NULL) || (create_runs(display) != 0))
+    {
+        delete_runs(display);
+        delete_lut(display);
+        free(display->modules);
+        return -1;
+    }
+
     DEBUG_MSG(stderr, "Initializing APA102...\n");
-    return apa102_init(&display->leds, &display->led_config);
+    if (init_chains(display) != 0)
+    {
+        delete_runs(display);
+        delete_lut(display);
+        free(display->modules);
+        return -1;
+    }
+
+    return 0;
 }
 
 
 int display_done(display_t *display)
 {
-    apa102_done(&display->leds);
+    delete_chains(display, display->chain_count);
+    delete_runs(display);
+    delete_lut(display);
     free(display->modules);
 
     return 0;
@@ -201,56 +776,355 @@ int display_done(display_t *display)
 
 int display_begin_frame(display_t *display, bool copy_last)
 {
-    return apa102_begin_frame(&display->leds, copy_last);
+    int c;
+    int ret = 0;
+
+    for (c = 0; c < display->chain_count; ++c)
+    {
+        ret |= apa102_begin_frame(display->chains->leds[c], copy_last);
+    }
+
+    return ret;
 }
 
 
+/*
+ * All the chains are finished before their renderers meet at the barrier.
+ */
 int display_finish_frame(display_t *display)
 {
-    return apa102_finish_frame(&display->leds);
+    int c;
+    int ret = 0;
+
+    for (c = 0; c < display->chain_count; ++c)
+    {
+        ret |= apa102_finish_frame(display->chains->leds[c]);
+    }
+
+    return ret;
 }
 
 
 int display_set_pixel(display_t *display, int x, int y, uint32_t argb, apa102_pix_mode_t mode)
 {
+    int pixel = get_led(display, x, y);
+
     DEBUG_FMT(stderr, "Setting pixel [%d, %d]\n", x, y);
 
-    display_module_t *m = get_module_by_position(display->modules, x, y);
-    if (m != NULL)
+    if (pixel >= 0)
+        return apa102_set_pixel(display->chains->leds[PIXMAP_CHAIN(pixel)], PIXMAP_LED(pixel), argb, mode);
+
+    DEBUG_MSG(stderr, "Module not found for that position!\n");
+
+    return -1;
+}
+
+
+int display_get_pixel(display_t *display, int x, int y, uint32_t *argb)
+{
+    int pixel = get_led(display, x, y);
+
+    if (pixel >= 0)
+        return apa102_get_pixel(display->chains->leds[PIXMAP_CHAIN(pixel)], PIXMAP_LED(pixel), argb);
+
+    return -1;
+}
+
+
+/*
+ * Chain's context (0 .. chain_count - 1, 0 is display_t.leds), NULL if
+ * there is no such chain.
+ */
+apa102_t *display_get_chain(display_t *display, int chain)
+{
+    if ((chain < 0) || (chain >= display->chain_count))
+        return NULL;
+
+    return display->chains->leds[chain];
+}
+
+
+/*
+ * LED for the position (PIXMAP_ENTRY() of the chain and the LED index in
+ * it, so just the index with a single chain), -1 if there is no LED.
+ */
+int display_get_led(display_t *display, int x, int y)
+{
+    return get_led(display, x, y);
+}
+
+
+/*
+ * Image of width x height pixels (stride pixels per row) placed at (x, y),
+ * clipped to the display; the holes swallow their pixels.
+ */
+int display_blit(display_t *display, int x, int y, int width, int height, int stride, const uint32_t *argb, apa102_pix_mode_t mode)
+{
+    int x0 = (x > 0) ? x : 0;
+    int y0 = (y > 0) ? y : 0;
+    int x1 = (x + width < display->size.width) ? x + width : display->size.width;
+    int y1 = (y + height < display->size.height) ? y + height : display->size.height;
+    int r;
+
+    if ((x0 >= x1) || (y0 >= y1))
+        return -1;
+
+    for (r = y0; r < y1; ++r)
     {
-        int pixel = get_led_offset(m, x, y);
-        return apa102_set_pixel(&display->leds, pixel, argb, mode);
+        blit_row(display, r, x0, x1, argb + (r - y) * stride + (x0 - x), mode, false);
+    }
+
+    return 0;
+}
+
+
+/*
+ * Horizontal line of width pixels from (x, y) to the right, clipped. Returns
+ * -1 if nothing of it is on the display, as all the primitives do.
+ */
+int display_hline(display_t *display, int x, int y, int width, uint32_t argb, apa102_pix_mode_t mode)
+{
+    if (width <= 0)
+        return -1;
+
+    return solid_span(display, y, x, x + width - 1, argb, mode);
+}
+
+
+/*
+ * Vertical line of height pixels from (x, y) down, clipped.
+ */
+int display_vline(display_t *display, int x, int y, int height, uint32_t argb, apa102_pix_mode_t mode)
+{
+    int y0 = (y > 0) ? y : 0;
+    int y1 = (y + height < display->size.height) ? y + height : display->size.height;
+
+    if ((x < 0) || (x >= display->size.width) || (y0 >= y1))
+        return -1;
+
+    solid_column(display, x, y0, y1, argb, mode);
+
+    return 0;
+}
+
+
+/*
+ * Filled rectangle, clipped. The solid row is prepared once for all its rows.
+ */
+int display_fill_rect(display_t *display, int x, int y, int width, int height, uint32_t argb, apa102_pix_mode_t mode)
+{
+    int             x0 = (x > 0) ? x : 0;
+    int             y0 = (y > 0) ? y : 0;
+    int             x1 = (x + width < display->size.width) ? x + width : display->size.width;
+    int             y1 = (y + height < display->size.height) ? y + height : display->size.height;
+    const uint32_t *row;
+    int             r;
+
+    if ((x0 >= x1) || (y0 >= y1))
+        return -1;
+
+    row = get_solid_row(display, x1 - x0, argb);
+    for (r = y0; r < y1; ++r)
+    {
+        blit_row(display, r, x0, x1, row, mode, true);
+    }
+
+    return 0;
+}
+
+
+/*
+ * Rectangle outline, clipped. Each pixel is painted once (the corners too),
+ * so the blending modes work as with a filled shape.
+ */
+int display_rect(display_t *display, int x, int y, int width, int height, uint32_t argb, apa102_pix_mode_t mode)
+{
+    int ret = -1;
+
+    if ((width <= 0) || (height <= 0))
+        return -1;
+
+    ret &= display_hline(display, x, y, width, argb, mode);
+    if (height > 1)
+        ret &= display_hline(display, x, y + height - 1, width, argb, mode);
+
+    if (height > 2)
+    {
+        ret &= display_vline(display, x, y + 1, height - 2, argb, mode);
+        if (width > 1)
+            ret &= display_vline(display, x + width - 1, y + 1, height - 2, argb, mode);
+    }
+
+    return ret;
+}
+
+
+/*
+ * Line from (x0, y0) to (x1, y1) both included, clipped (Bresenham). Only the
+ * steps whose major axis coordinate is on the display are walked: the first
+ * one's minor coordinate and error term are worked out directly, so the
+ * pixels are the ones the whole walk would give. The pixels of a row are put
+ * together as a span, so the flat lines are a few span calls.
+ */
+int display_line(display_t *display, int x0, int y0, int x1, int y1, uint32_t argb, apa102_pix_mode_t mode)
+{
+    int64_t  dx       = (x1 > x0) ? (int64_t)x1 - x0 : (int64_t)x0 - x1;
+    int64_t  dy       = (y1 > y0) ? (int64_t)y0 - y1 : (int64_t)y1 - y0;
+    int      sx       = (x1 > x0) ? 1 : -1;
+    int      sy       = (y1 > y0) ? 1 : -1;
+    bool     is_steep = (-dy > dx);
+    int64_t  major    = is_steep ? -dy : dx;
+    int64_t  minor    = is_steep ? dx : -dy;
+    int64_t  first;
+    int64_t  last;
+    int64_t  moved    = 0;
+    int64_t  delta    = 0;
+    int64_t  err;
+    int64_t  k;
+    int      span_x;
+    int      ret      = -1;
+
+    if (!get_line_steps(is_steep ? y0 : x0, is_steep ? sy : sx, major,
+                        is_steep ? display->size.height : display->size.width, &first, &last))
+        return -1;
+
+    /* Minor axis moves after first steps: round(first * minor / major) */
+    if (major > 0)
+    {
+        uint64_t product = (uint64_t)first * (uint64_t)minor;
+        int64_t  rest    = (int64_t)(product % (uint64_t)major);
+
+        moved = (int64_t)(product / (uint64_t)major) + ((2 * rest >= major) ? 1 : 0);
+        delta = (2 * rest >= major) ? rest - major : rest;
+    }
+
+    if (is_steep)
+    {
+        err = minor - major + delta;
+        x0  = (int)(x0 + sx * moved);
+        y0  = (int)(y0 + sy * first);
     }
     else
     {
-        DEBUG_MSG(stderr, "Module not found for that position!\n");
+        err = major - minor - delta;
+        x0  = (int)(x0 + sx * first);
+        y0  = (int)(y0 + sy * moved);
     }
+    span_x = x0;
 
-    return -1;
+    for (k = first; k < last; ++k)
+    {
+        int64_t e2 = 2 * err;
+        int     nx = x0;
+        int     ny = y0;
+
+        if (e2 >= dy)
+        {
+            err += dy;
+            nx  += sx;
+        }
+        if (e2 <= dx)
+        {
+            err += dx;
+            ny  += sy;
+        }
+
+        if (ny != y0)
+        {
+            ret   &= solid_span(display, y0, span_x, x0, argb, mode);
+            span_x = nx;
+        }
+        x0 = nx;
+        y0 = ny;
+    }
+
+    return ret & solid_span(display, y0, span_x, x0, argb, mode);
 }
 
 
-int display_get_pixel(display_t *display, int x, int y, uint32_t *argb)
+/*
+ * Circle outline of radius r around (cx, cy), clipped. The disc is the
+ * midpoint circle's one (x * x + dy * dy <= r * r + r), each row gets the
+ * columns of the disc the next row outwards does not cover (two spans, one at
+ * the top and bottom), so each pixel is painted once. Only the rows on the
+ * display are worked out, in 64 bits so any radius is fine.
+ */
+int display_circle(display_t *display, int cx, int cy, int r, uint32_t argb, apa102_pix_mode_t mode)
 {
-    return -1;
+    int64_t disc = (int64_t)r * r + r;
+    int64_t top  = -(int64_t)cy;
+    int64_t bot  = (int64_t)display->size.height - 1 - cy;
+    int64_t from;
+    int64_t to;
+    int64_t half;
+    int64_t dy;
+    int     ret  = -1;
+
+    if (   (r < 0)
+        || ((int64_t)cx + r < 0) || ((int64_t)cx - r >= display->size.width)
+        || (bot < -(int64_t)r)   || (top > r))
+        return -1;
+
+    /* Row distances from the center covering the display rows */
+    if ((top <= 0) && (bot >= 0))
+    {
+        from = 0;
+        to   = (-top > bot) ? -top : bot;
+    }
+    else
+    {
+        from = (top > 0) ? top : -bot;
+        to   = (top > 0) ? bot : -top;
+    }
+    to   = (to < r) ? to : r;
+    half = isqrt64(disc - from * from);
+
+    for (dy = from; dy <= to; ++dy)
+    {
+        int64_t outer = (dy < r) ? isqrt64(disc - (dy + 1) * (dy + 1)) : -1;
+        int64_t inner = (outer + 1 < half) ? outer + 1 : half;
+
+        ret &= circle_row(display, cx, cy + dy, inner, half, argb, mode);
+        if (dy > 0)
+            ret &= circle_row(display, cx, cy - dy, inner, half, argb, mode);
+
+        half = outer;
+    }
+
+    return ret;
 }
 
 
 void display_clear(display_t *display)
 {
-    apa102_clear(&display->leds);
+    int c;
+
+    for (c = 0; c < display->chain_count; ++c)
+    {
+        apa102_clear(display->chains->leds[c]);
+    }
 }
 
 
 void display_fill(display_t *display, uint32_t argb)
 {
-    apa102_fill(&display->leds, argb);
+    int c;
+
+    for (c = 0; c < display->chain_count; ++c)
+    {
+        apa102_fill(display->chains->leds[c], argb);
+    }
 }
 
 
 void display_set_brightness(display_t *display, uint8_t brightness)
 {
-    apa102_set_brightness(&display->leds, brightness);
+    int c;
+
+    for (c = 0; c < display->chain_count; ++c)
+    {
+        apa102_set_brightness(display->chains->leds[c], brightness);
+    }
 }
 
 
@@ -8,6 +8,7 @@
 #define __DISPLAY_H__
 
 #include "apa102.h"
+#include "pixmap.h"
 
 
 /*****************************************************************************
@@ -44,6 +45,7 @@ typedef struct display_module_config_tt
     display_module_anchor_t  anchor;
     display_position_t       position;
     display_size_t           size;
+    int                      chain;     /**< Chain the module is connected to (display_config_t.chains) */
 } display_module_config_t;
 
 
@@ -58,12 +60,46 @@ typedef struct display_module_tt
 } display_module_t;
 
 
+/**
+ * Row segment mapped to the chain in one go
+ */
+typedef struct display_run_tt
+{
+    int x;      /**< First column                                              */
+    int count;  /**< Number of pixels                                          */
+    int chain;  /**< Chain of all the run's LEDs                               */
+    int led;    /**< LED of the first column (scattered: first of its scatter) */
+    int step;   /**< LED step per column (+1, -1, 0: scattered)                */
+} display_run_t;
+
+
+/**
+ * LED chain of the display, each one has its own renderer
+ */
+typedef struct display_chain_config_tt
+{
+    const char *spi_device;  /**< SPI Device name */
+    int         spi_speed;   /**< SPI Speed in Hz */
+} display_chain_config_t;
+
+
+/**
+ * Chains of the display and their lockstep (display.c private)
+ */
+typedef struct display_chains_tt display_chains_t;
+
+
 typedef struct display_config_tt
 {
-    const char                    *spi_device;   /**< SPI Device name */
-    int                            spi_speed;    /**< SPI Speed in Hz */
+    const char                    *spi_device;   /**< SPI Device name (single chain) */
+    int                            spi_speed;    /**< SPI Speed in Hz (single chain) */
+    const apa102spi_backend_t     *backend;      /**< Output backend (NULL: SPIdev) */
     const display_module_config_t *modules;
     int                            module_count;
+    const char                    *pixel_map;    /**< Pixel map file used instead of the modules (NULL: modules) */
+    const char                    *lut_cache;    /**< Compiled pixel map cache file (NULL: none) */
+    const display_chain_config_t  *chains;       /**< Chains the modules refer to */
+    int                            chain_count;  /**< Number of chains (0: one on spi_device) */
 } display_config_t;
 
 
@@ -71,8 +107,17 @@ typedef struct display_tt
 {
     const display_config_t *config;
     display_module_t       *modules;
-    apa102_config_t         led_config;
-    apa102_t                leds;
+    display_size_t          size;        /**< Bounding box of the modules             */
+    int32_t                *lut;         /**< PIXMAP_ENTRY() per (x, y), row-major, -1 for holes */
+    display_run_t          *runs;        /**< Row runs, row by row                    */
+    int                    *row_runs;    /**< First run of each row (height + 1)      */
+    int                    *scatter;     /**< LEDs of the scattered runs              */
+    uint32_t               *row_buf;     /**< Reversed run colors (width)             */
+    pixmap_t                pixmap;      /**< LUT owner when a pixel map is used      */
+    int                     chain_count;
+    apa102_config_t         led_config;  /**< Chain 0                                 */
+    apa102_t                leds;        /**< Chain 0, display_get_chain() for any    */
+    display_chains_t       *chains;      /**< All the chains and their lockstep       */
 } display_t;
 
 
@@ -85,6 +130,15 @@ int  display_begin_frame   (display_t *display, bool copy_last);
 int  display_finish_frame  (display_t *display);
 int  display_set_pixel     (display_t *display, int x, int y, uint32_t argb, apa102_pix_mode_t mode);
 int  display_get_pixel     (display_t *display, int x, int y, uint32_t *argb);
+int  display_get_led       (display_t *display, int x, int y);
+apa102_t *display_get_chain(display_t *display, int chain);
+int  display_blit          (display_t *display, int x, int y, int width, int height, int stride, const uint32_t *argb, apa102_pix_mode_t mode);
+int  display_hline         (display_t *display, int x, int y, int width, uint32_t argb, apa102_pix_mode_t mode);
+int  display_vline         (display_t *display, int x, int y, int height, uint32_t argb, apa102_pix_mode_t mode);
+int  display_fill_rect     (display_t *display, int x, int y, int width, int height, uint32_t argb, apa102_pix_mode_t mode);
+int  display_rect          (display_t *display, int x, int y, int width, int height, uint32_t argb, apa102_pix_mode_t mode);
+int  display_line          (display_t *display, int x0, int y0, int x1, int y1, uint32_t argb, apa102_pix_mode_t mode);
+int  display_circle        (display_t *display, int cx, int cy, int r, uint32_t argb, apa102_pix_mode_t mode);
 void display_clear         (display_t *display);
 void display_fill          (display_t *display, uint32_t argb);
 void display_set_brightness(display_t *display, uint8_t brightness);
@@ -1,9 +1,12 @@
-#include <unistd.h>
+#include <stdint.h>
 #include "debug.h"
+#include "pacer.h"
 #include "display.h"
 
 #define SPI_DEVICE  "/dev/spidev0.0"
 #define SPI_SPEED   10000000
+#define FPS         100
+#define PAUSE_NS    1000000000ULL  /* dark pause after each pulse */
 
 
 static const display_module_config_t display_modules[] =
@@ -61,22 +64,32 @@ const int sin_count = sizeof(sinus) / sizeof(int);
 int main(int argc, char *argv[])
 {
     display_t display;    
+    pacer_t   pacer;
+    uint64_t  start_ns;
+    uint64_t  frame_ns;
     int s, b;
 
     debug_init();
     display_init(&display, &display_config);
+    pacer_init(&pacer, FPS, PACER_POLICY_DROP);
 
-
-    s = 0;
+    /* Brightness follows the time, so it keeps the pace even if frames drop */
+    pacer_wait(&pacer, &start_ns);
+    frame_ns = start_ns;
     while (1)
     {
-        b = sinus[s++];
-        if (s >= sin_count) 
+        uint64_t pulse_ns = sin_count * pacer.period_ns;
+        uint64_t t        = (frame_ns - start_ns) % (pulse_ns + PAUSE_NS);
+
+        if (t >= pulse_ns)
         {
-            s = 0;
-            usleep(1000 * 1000);
+            pacer_wait(&pacer, &frame_ns);
+            continue;
         }
 
+        s = t / pacer.period_ns;
+        b = sinus[s];
+
         display_set_brightness(&display, b);
         display_begin_frame(&display, false);
         {
@@ -86,20 +99,9 @@ int main(int argc, char *argv[])
 
             do
             {
-                int p;
                 uint32_t c = get_color(i++);
-                
-                for (p = topleft.x; p <= btmright.x; ++p)
-                {
-                    display_set_pixel(&display, p, topleft.y, c, APA102_PIX_MODE_COPY);
-                    display_set_pixel(&display, p, btmright.y, c, APA102_PIX_MODE_COPY);
-                }
-
-                for (p = topleft.y + 1; p < btmright.y; ++p)
-                {
-                    display_set_pixel(&display, topleft.x, p, c, APA102_PIX_MODE_COPY);
-                    display_set_pixel(&display, btmright.x, p, c, APA102_PIX_MODE_COPY);
-                }
+
+                display_rect(&display, topleft.x, topleft.y, btmright.x - topleft.x + 1, btmright.y - topleft.y + 1, c, APA102_PIX_MODE_COPY);
 
                 topleft.x += 2;
                 topleft.y += 2;
@@ -111,7 +113,7 @@ int main(int argc, char *argv[])
         }
         display_finish_frame(&display);
 
-        usleep(10 * 1000);
+        pacer_wait(&pacer, &frame_ns);
     }
 
     display_done(&display);
@@ -14,6 +14,7 @@
 #define FIFO_NEXT(f, i)  ((i + 1) % (((f).size) + 1))
 #define FIFO_EMPTY(f)    ((f).rd == (f).wr)
 #define FIFO_FULL(f)     (FIFO_NEXT(f, (f).wr) == (f).rd)
+#define FIFO_COUNT(f)    ((((f).wr) - ((f).rd) + ((f).size) + 1) % (((f).size) + 1))
 
 
 /*****************************************************************************
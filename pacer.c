@@ -0,0 +1,150 @@
+/*************************************************************************//**
+ * @file pacer.c
+ *
+ *     Deadline based frame pacing for the producers
+ *
+ *   Frames are due on a fixed grid of CLOCK_MONOTONIC timestamps, the
+ * producer sleeps until the deadline (absolute, so no drift accumulates) and
+ * renders the frame for the handed timestamp:
+ *
+ *       pacer_wait(&pacer, &t);
+ *       apa102_begin_frame(&leds, false);
+ *       ... paint the scene at time t ...
+ *       apa102_finish_frame(&leds);
+ *
+ *   A producer more than one period late either skips the missed frames
+ * (drop, the animation keeps its speed) or continues from now (slip, no
+ * frame is lost, the animation slows down).
+ *
+ ****************************************************************************/
+#include <stdint.h>
+#include <errno.h>
+#include <time.h>
+#include "pacer.h"
+
+
+/*****************************************************************************
+ * Private macros
+ ****************************************************************************/
+#define NSEC_PER_SEC 1000000000ULL
+
+
+/*****************************************************************************
+ * Private functions
+ ****************************************************************************/
+
+
+static uint64_t get_ns(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+
+    return (uint64_t)ts.tv_sec * NSEC_PER_SEC + ts.tv_nsec;
+}
+
+
+static void sleep_until(uint64_t ns)
+{
+    struct timespec ts = {.tv_sec = ns / NSEC_PER_SEC, .tv_nsec = ns % NSEC_PER_SEC};
+
+    while (clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &ts, NULL) == EINTR)
+        ;
+}
+
+
+/*****************************************************************************
+ * Public functions
+ ****************************************************************************/
+
+
+/*************************************************************************//**
+ * Initialize pacer
+ *
+ * @param[in,out]    pacer     Pacer context
+ * @param[in]        fps       Target frame rate
+ * @param[in]        policy    Falling behind policy
+ *
+ * @return    zero on success, nonzero otherwise (invalid rate)
+ *
+ ****************************************************************************/
+int pacer_init(pacer_t *pacer, int fps, pacer_policy_t policy)
+{
+    if (fps <= 0)
+        return -1;
+
+    pacer->policy    = policy;
+    pacer->period_ns = NSEC_PER_SEC / fps;
+    pacer->frames    = 0;
+    pacer->dropped   = 0;
+    pacer->slipped   = 0;
+    pacer->next_ns   = 0;
+
+    return 0;
+}
+
+
+/*************************************************************************//**
+ * Wait for the next frame
+ *
+ * The first frame is due immediately, the following ones one period apart.
+ *
+ * @param[in,out]    pacer       Pacer context
+ * @param[out]       frame_ns    Timestamp of the frame to be rendered
+ *                               (CLOCK_MONOTONIC)
+ *
+ * @return    number of frames skipped before this one (drop policy)
+ *
+ ****************************************************************************/
+int pacer_wait(pacer_t *pacer, uint64_t *frame_ns)
+{
+    uint64_t now    = get_ns();
+    uint64_t behind = 0;
+
+    if (pacer->next_ns == 0)
+        pacer->next_ns = now;
+
+    if (now < pacer->next_ns)
+        sleep_until(pacer->next_ns);
+    else if (now - pacer->next_ns >= pacer->period_ns)
+    {
+        /* Whole frames missed, late less than a period is just rendered */
+        if (pacer->policy == PACER_POLICY_DROP)
+        {
+            behind          = (now - pacer->next_ns) / pacer->period_ns;
+            pacer->next_ns += behind * pacer->period_ns;
+            pacer->dropped += behind;
+        }
+        else
+        {
+            pacer->next_ns  = now;
+            pacer->slipped += 1;
+        }
+    }
+
+    *frame_ns       = pacer->next_ns;
+    pacer->next_ns += pacer->period_ns;
+    pacer->frames  += 1;
+
+    return (int)behind;
+}
+
+
+/*************************************************************************//**
+ * Restart the schedule
+ *
+ * After an intended pause, the next frame is due immediately again instead
+ * of being counted as late.
+ *
+ * @param[in,out]    pacer    Pacer context
+ *
+ ****************************************************************************/
+void pacer_reset(pacer_t *pacer)
+{
+    pacer->next_ns = 0;
+}
+
+
+/*****************************************************************************
+ * End of file
+ ****************************************************************************/
@@ -0,0 +1,53 @@
+/*************************************************************************//**
+ * @file pacer.h
+ *
+ *     Deadline based frame pacing for the producers
+ *
+ ****************************************************************************/
+#ifndef __PACER_H__
+#define __PACER_H__
+
+#include <stdint.h>
+
+
+/*****************************************************************************
+ * Public types
+ ****************************************************************************/
+
+
+/**
+ * What to do when the producer falls behind
+ */
+typedef enum pacer_policy_tt
+{
+    PACER_POLICY_DROP,  /**< Missed frames are skipped, timestamps stay on the grid */
+    PACER_POLICY_SLIP,  /**< Every frame is rendered, the schedule moves later      */
+} pacer_policy_t;
+
+
+/**
+ * Pacer context
+ */
+typedef struct pacer_tt
+{
+    pacer_policy_t policy;      /**< Falling behind policy                 */
+    uint64_t       period_ns;   /**< Frame period                          */
+    uint64_t       next_ns;     /**< Deadline of the next frame (0: none)  */
+    uint64_t       frames;      /**< Frames handed to the producer         */
+    uint64_t       dropped;     /**< Frames skipped (drop policy)          */
+    uint64_t       slipped;     /**< Schedule moves (slip policy)          */
+} pacer_t;
+
+
+/*****************************************************************************
+ * Public prototypes
+ ****************************************************************************/
+int  pacer_init(pacer_t *pacer, int fps, pacer_policy_t policy);
+int  pacer_wait(pacer_t *pacer, uint64_t *frame_ns);
+void pacer_reset(pacer_t *pacer);
+
+
+#endif
+/*****************************************************************************
+ * End of file
+ ****************************************************************************/
@@ -0,0 +1,396 @@
+/*************************************************************************//**
+ * @file pixmap.c
+ *
+ *     Arbitrary LED layouts, pixel map files compiled to a lookup table
+ *
+ *   The pixel map is a text file, a line per LED giving its index in the
+ * chain, its position and optionally the chain (0 by default):
+ *
+ *       # index x y [chain]
+ *       0 12 0
+ *       1 13 1
+ *       0 40 0 1
+ *       ...
+ *
+ * blank lines and '#' comments are skipped, LEDs not listed have no position
+ * (they are not addressable by (x, y)), positions not listed are holes. So
+ * rings, diagonal strips or irregular panels might be described by whatever
+ * tool generated them.
+ *
+ *   It is compiled to the same lookup table as the display modules are
+ * (PIXMAP_ENTRY() of chain and LED per (x, y), row-major, -1 for holes). With
+ * the cache file given, the table is written there once and mapped on the
+ * next starts as long as the pixel map keeps its size and modification time,
+ * so even a big installation starts without parsing. The cache is native
+ * endian, meant for the machine that wrote it.
+ *
+ ****************************************************************************/
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include "debug.h"
+#include "pixmap.h"
+
+
+/*****************************************************************************
+ * Private macros
+ ****************************************************************************/
+#define CACHE_MAGIC    "APA102LT"
+#define CACHE_VERSION  2
+#define MAX_SIDE       16384  /* positions are sanity checked against this */
+#define LINE_LEN       256
+
+
+/*****************************************************************************
+ * Private types
+ ****************************************************************************/
+
+
+/**
+ * Cache file header, followed by width * height int32_t LEDs
+ */
+typedef struct pixmap_header_tt
+{
+    char     magic[8];     /**< CACHE_MAGIC                   */
+    uint32_t version;      /**< CACHE_VERSION                 */
+    int32_t  width;
+    int32_t  height;
+    int32_t  chain_count;
+    int32_t  chain_pixels[PIXMAP_MAX_CHAINS];
+    uint64_t src_size;     /**< Pixel map file it was made of */
+    uint64_t src_mtime_ns;
+} pixmap_header_t;
+
+
+/**
+ * Pixel map line
+ */
+typedef struct pixmap_entry_tt
+{
+    int led;
+    int x;
+    int y;
+    int chain;
+} pixmap_entry_t;
+
+
+/*****************************************************************************
+ * Private functions
+ ****************************************************************************/
+
+
+static void init_header(pixmap_header_t *header, const pixmap_t *pixmap, const struct stat *src)
+{
+    memset(header, 0, sizeof(*header));
+    memcpy(header->magic, CACHE_MAGIC, sizeof(header->magic));
+    header->version      = CACHE_VERSION;
+    header->width        = pixmap->width;
+    header->height       = pixmap->height;
+    header->chain_count  = pixmap->chain_count;
+    memcpy(header->chain_pixels, pixmap->chain_pixels, sizeof(header->chain_pixels));
+    header->src_size     = (src != NULL) ? (uint64_t)src->st_size : 0;
+    header->src_mtime_ns = (src != NULL) ? (uint64_t)src->st_mtim.tv_sec * 1000000000ULL + src->st_mtim.tv_nsec : 0;
+}
+
+
+/*
+ * Every entry must be a hole or a LED within its chain, the display indexes
+ * the chains and their frames by them unchecked.
+ */
+static bool is_lut_valid(const pixmap_t *pixmap)
+{
+    size_t i;
+    int    c;
+
+    for (c = 0; c < pixmap->chain_count; ++c)
+    {
+        if ((pixmap->chain_pixels[c] < 0) || (pixmap->chain_pixels[c] > PIXMAP_LED_MASK + 1))
+            return false;
+    }
+
+    for (i = 0; i < (size_t)pixmap->width * pixmap->height; ++i)
+    {
+        int32_t e = pixmap->lut[i];
+
+        if (e == -1)
+            continue;
+
+        if (   (e < 0)
+            || (PIXMAP_CHAIN(e) >= pixmap->chain_count)
+            || (PIXMAP_LED(e) >= pixmap->chain_pixels[PIXMAP_CHAIN(e)]))
+            return false;
+    }
+
+    return true;
+}
+
+
+/*
+ * Cache is used if it was made of the pixel map as it is now (or whatever it
+ * was made of, when there is no pixel map at all).
+ */
+static int map_cache(pixmap_t *pixmap, const char *cache, const struct stat *src)
+{
+    pixmap_header_t  header;
+    pixmap_header_t *mapped;
+    struct stat      st;
+    void            *map;
+    int              fd;
+
+    fd = open(cache, O_RDONLY | O_CLOEXEC);
+    if (fd < 0)
+        return -1;
+
+    if (   (fstat(fd, &st) != 0)
+        || ((size_t)st.st_size < sizeof(pixmap_header_t)))
+    {
+        close(fd);
+        return -1;
+    }
+
+    map = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE | MAP_POPULATE, fd, 0);
+    close(fd);
+    if (map == MAP_FAILED)
+        return -1;
+
+    mapped = (pixmap_header_t *)map;
+    pixmap->width       = mapped->width;
+    pixmap->height      = mapped->height;
+    pixmap->chain_count = mapped->chain_count;
+    memcpy(pixmap->chain_pixels, mapped->chain_pixels, sizeof(pixmap->chain_pixels));
+    init_header(&header, pixmap, src);
+
+    if (   (memcmp(mapped->magic, CACHE_MAGIC, sizeof(mapped->magic)) != 0)
+        || (mapped->version != CACHE_VERSION)
+        || (mapped->width < 0) || (mapped->height < 0)
+        || (mapped->chain_count < 0) || (mapped->chain_count > PIXMAP_MAX_CHAINS)
+        || ((size_t)st.st_size != sizeof(pixmap_header_t) + (size_t)mapped->width * mapped->height * sizeof(int32_t))
+        || ((src != NULL) && ((mapped->src_size != header.src_size) || (mapped->src_mtime_ns != header.src_mtime_ns))))
+    {
+        DEBUG_FMT(stderr, "Pixel map cache %s is stale or broken\n", cache);
+        munmap(map, st.st_size);
+        return -1;
+    }
+
+    pixmap->lut = (int32_t *)(mapped + 1);
+    if (!is_lut_valid(pixmap))
+    {
+        DEBUG_FMT(stderr, "Pixel map cache %s has entries out of its chains\n", cache);
+        munmap(map, st.st_size);
+        pixmap->lut = NULL;
+        return -1;
+    }
+
+    pixmap->is_cached = true;
+    pixmap->map       = map;
+    pixmap->map_len   = st.st_size;
+
+    return 0;
+}
+
+
+/*
+ * Written aside and renamed, so a reader never maps a half written table.
+ */
+static void write_cache(const pixmap_t *pixmap, const char *cache, const struct stat *src)
+{
+    pixmap_header_t header;
+    char            tmp[4096];
+    size_t          len = (size_t)pixmap->width * pixmap->height * sizeof(int32_t);
+    FILE           *f;
+    bool            is_ok;
+
+    snprintf(tmp, sizeof(tmp), "%s.%d", cache, (int)getpid());
+    f = fopen(tmp, "wb");
+    if (f == NULL)
+    {
+        DEBUG_FMT(stderr, "Cannot write pixel map cache %s\n", tmp);
+        return;
+    }
+
+    init_header(&header, pixmap, src);
+    is_ok = (fwrite(&header, sizeof(header), 1, f) == 1)
+         && ((len == 0) || (fwrite(pixmap->lut, len, 1, f) == 1));
+    is_ok = (fclose(f) == 0) && is_ok;
+
+    if (!is_ok || (rename(tmp, cache) != 0))
+    {
+        DEBUG_FMT(stderr, "Cannot write pixel map cache %s\n", cache);
+        unlink(tmp);
+    }
+}
+
+
+static int parse_map(pixmap_t *pixmap, const char *path)
+{
+    pixmap_entry_t *entries  = NULL;
+    int             count    = 0;
+    int             capacity = 0;
+    int             line_no  = 0;
+    char            line[LINE_LEN];
+    FILE           *f;
+    int             i;
+
+    f = fopen(path, "r");
+    if (f == NULL)
+    {
+        DEBUG_FMT(stderr, "Cannot open pixel map %s\n", path);
+        return -1;
+    }
+
+    pixmap->width       = 0;
+    pixmap->height      = 0;
+    pixmap->chain_count = 0;
+    memset(pixmap->chain_pixels, 0, sizeof(pixmap->chain_pixels));
+
+    while (fgets(line, sizeof(line), f) != NULL)
+    {
+        pixmap_entry_t e = {.chain = 0};
+        char          *p = line + strspn(line, " \t");
+        int            n;
+
+        ++line_no;
+        if ((*p == '#') || (*p == '\n') || (*p == '\r') || (*p == '\0'))
+            continue;
+
+        n = sscanf(p, "%d %d %d %d", &e.led, &e.x, &e.y, &e.chain);
+        if (   ((n != 3) && (n != 4))
+            || (e.led < 0) || (e.led > PIXMAP_LED_MASK)
+            || (e.x < 0) || (e.x >= MAX_SIDE) || (e.y < 0) || (e.y >= MAX_SIDE)
+            || (e.chain < 0) || (e.chain >= PIXMAP_MAX_CHAINS))
+        {
+            DEBUG_FMT(stderr, "Pixel map %s:%d: expected \"index x y [chain]\"\n", path, line_no);
+            free(entries);
+            fclose(f);
+            return -1;
+        }
+
+        if (count == capacity)
+        {
+            pixmap_entry_t *grown;
+
+            capacity = (capacity > 0) ? capacity * 2 : 1024;
+            grown    = (pixmap_entry_t *)realloc(entries, capacity * sizeof(pixmap_entry_t));
+            if (grown == NULL)
+            {
+                free(entries);
+                fclose(f);
+                return -1;
+            }
+            entries = grown;
+        }
+
+        entries[count++] = e;
+        pixmap->width                 = (e.x + 1 > pixmap->width)                   ? e.x + 1     : pixmap->width;
+        pixmap->height                = (e.y + 1 > pixmap->height)                  ? e.y + 1     : pixmap->height;
+        pixmap->chain_count           = (e.chain + 1 > pixmap->chain_count)         ? e.chain + 1 : pixmap->chain_count;
+        pixmap->chain_pixels[e.chain] = (e.led + 1 > pixmap->chain_pixels[e.chain]) ? e.led + 1   : pixmap->chain_pixels[e.chain];
+    }
+    fclose(f);
+
+    pixmap->lut = (int32_t *)malloc(((size_t)pixmap->width * pixmap->height + 1) * sizeof(int32_t));
+    if (pixmap->lut == NULL)
+    {
+        free(entries);
+        return -1;
+    }
+
+    /* First LED listed at a position wins, as the first module does */
+    for (i = 0; i < pixmap->width * pixmap->height; ++i)
+    {
+        pixmap->lut[i] = -1;
+    }
+    for (i = 0; i < count; ++i)
+    {
+        int32_t *led = &pixmap->lut[entries[i].y * pixmap->width + entries[i].x];
+
+        if (*led < 0)
+            *led = PIXMAP_ENTRY(entries[i].chain, entries[i].led);
+    }
+
+    DEBUG_FMT(stderr, "Pixel map %s: %d LEDs, %d chain(s), %dx%d\n", path, count, pixmap->chain_count, pixmap->width, pixmap->height);
+    free(entries);
+
+    return 0;
+}
+
+
+/*****************************************************************************
+ * Public functions
+ ****************************************************************************/
+
+
+/*************************************************************************//**
+ * Load pixel map
+ *
+ * The cache is mapped if it is up to date, otherwise the pixel map is parsed
+ * and the cache (re)written. Either of them might be missing (NULL), not both.
+ * The cache alone is taken as it is only without the pixel map given, a
+ * pixel map given but missing fails.
+ *
+ * @param[out]    pixmap    Compiled pixel map
+ * @param[in]     path      Pixel map file (NULL: cache only)
+ * @param[in]     cache     Lookup table cache file (NULL: no cache)
+ *
+ * @return    zero on success, nonzero otherwise
+ *
+ ****************************************************************************/
+int pixmap_load(pixmap_t *pixmap, const char *path, const char *cache)
+{
+    struct stat  st;
+    struct stat *src = NULL;
+
+    memset(pixmap, 0, sizeof(*pixmap));
+
+    if (path != NULL)
+    {
+        if (stat(path, &st) != 0)
+        {
+            DEBUG_FMT(stderr, "Cannot open pixel map %s\n", path);
+            return -1;
+        }
+        src = &st;
+    }
+
+    if ((cache != NULL) && (map_cache(pixmap, cache, src) == 0))
+    {
+        DEBUG_FMT(stderr, "Pixel map cache %s: %d chain(s), %dx%d\n", cache, pixmap->chain_count, pixmap->width, pixmap->height);
+        return 0;
+    }
+
+    if ((path == NULL) || (parse_map(pixmap, path) != 0))
+        return -1;
+
+    if (cache != NULL)
+        write_cache(pixmap, cache, src);
+
+    return 0;
+}
+
+
+/*************************************************************************//**
+ * Release pixel map
+ *
+ * @param[in,out]    pixmap    Compiled pixel map
+ *
+ ****************************************************************************/
+void pixmap_free(pixmap_t *pixmap)
+{
+    if (pixmap->is_cached)
+        munmap(pixmap->map, pixmap->map_len);
+    else
+        free(pixmap->lut);
+
+    memset(pixmap, 0, sizeof(*pixmap));
+}
+
+
+/*****************************************************************************
+ * End of file
+ ****************************************************************************/
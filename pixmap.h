@@ -0,0 +1,57 @@
+/*************************************************************************//**
+ * @file pixmap.h
+ *
+ *     Arbitrary LED layouts, pixel map files compiled to a lookup table
+ *
+ ****************************************************************************/
+#ifndef __PIXMAP_H__
+#define __PIXMAP_H__
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <stddef.h>
+
+
+/*****************************************************************************
+ * Public macros
+ ****************************************************************************/
+#define PIXMAP_MAX_CHAINS   16
+#define PIXMAP_CHAIN_SHIFT  24                               /* LUT entry: chain << 24 | LED */
+#define PIXMAP_LED_MASK     ((1 << PIXMAP_CHAIN_SHIFT) - 1)
+#define PIXMAP_ENTRY(c, l)  (((c) << PIXMAP_CHAIN_SHIFT) | (l))
+#define PIXMAP_CHAIN(e)     ((e) >> PIXMAP_CHAIN_SHIFT)
+#define PIXMAP_LED(e)       ((e) & PIXMAP_LED_MASK)
+
+
+/*****************************************************************************
+ * Public types
+ ****************************************************************************/
+
+
+/**
+ * Compiled pixel map
+ */
+typedef struct pixmap_tt
+{
+    int32_t *lut;                               /**< Entry (PIXMAP_ENTRY()) per (x, y), row-major, -1 for holes */
+    int      width;                             /**< Bounding box of the mapped positions                     */
+    int      height;
+    int      chain_count;                       /**< Chains used (highest chain + 1)                          */
+    int      chain_pixels[PIXMAP_MAX_CHAINS];   /**< LEDs in each chain (highest index + 1)                   */
+    bool     is_cached;                         /**< Table mapped from the cache file                         */
+    void    *map;                               /**< Cache mapping (is_cached)                                */
+    size_t   map_len;
+} pixmap_t;
+
+
+/*****************************************************************************
+ * Public prototypes
+ ****************************************************************************/
+int  pixmap_load(pixmap_t *pixmap, const char *path, const char *cache);
+void pixmap_free(pixmap_t *pixmap);
+
+
+#endif
+/*****************************************************************************
+ * End of file
+ ****************************************************************************/
@@ -0,0 +1,249 @@
+/*************************************************************************//**
+ * @file spsc_fifo.c
+ *
+ *     Lock-free single producer / single consumer FIFO
+ *
+ *   Drop-in alternative to sync_fifo for queues having exactly one putting
+ * and one getting thread. Items are passed via atomic indices only, the
+ * kernel (futex) is entered just when the FIFO is really empty (full) and
+ * the caller wants to wait, the other end wakes it only if somebody is
+ * registered as waiting.
+ *
+ ****************************************************************************/
+#include <stdio.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <malloc.h>
+#include <unistd.h>
+#include <time.h>
+#include <sys/syscall.h>
+#include <linux/futex.h>
+#include "spsc_fifo.h"
+
+
+/*******************************************************************************
+ * Private functions
+ ******************************************************************************/
+
+
+/* Relative timeout (NULL: none), CLOCK_MONOTONIC */
+static void futex_wait(uint32_t *addr, uint32_t val, const struct timespec *timeout)
+{
+    syscall(SYS_futex, addr, FUTEX_WAIT_PRIVATE, val, timeout, NULL, 0);
+}
+
+
+static void futex_wake(uint32_t *addr)
+{
+    syscall(SYS_futex, addr, FUTEX_WAKE_PRIVATE, 1, NULL, NULL, 0);
+}
+
+
+static uint64_t get_ns(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+
+    return (uint64_t)ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+
+static uint32_t round_pow2(int size)
+{
+    uint32_t n = 1;
+
+    while (n < (uint32_t)size)
+        n <<= 1;
+
+    return n;
+}
+
+
+/*******************************************************************************
+ * Public functions
+ ******************************************************************************/
+
+
+/*************************************************************************//**
+ * Initialize FIFO
+ *
+ * @param[in,out]    fifo    FIFO context
+ * @param[in]        size    Number of items the FIFO can hold
+ * @param[in]        name    FIFO name (not used for anything)
+ *
+ ****************************************************************************/
+void spsc_fifo_init(spsc_fifo_t *fifo, int size, char *name)
+{
+    uint32_t slots = round_pow2(size);
+
+    fifo->name       = name;
+    fifo->size       = size;
+    fifo->mask       = slots - 1;
+    fifo->data       = (void **)malloc(slots * sizeof(void *));
+    fifo->wr         = 0;
+    fifo->rd         = 0;
+    fifo->ne_waiters = 0;
+    fifo->nf_waiters = 0;
+}
+
+
+/*************************************************************************//**
+ * Finalize FIFO
+ *
+ * @param[in,out]    fifo    FIFO context
+ *
+ ****************************************************************************/
+void spsc_fifo_done(spsc_fifo_t *fifo)
+{
+    free(fifo->data);
+    fifo->data = NULL;
+    fifo->size = 0;
+}
+
+
+/*************************************************************************//**
+ * Insert item into FIFO
+ *
+ * Must be called from the producer thread only.
+ *
+ * @param[in,out]    fifo          FIFO context
+ * @param[in]        item          Item to be inserted
+ * @param[in]        is_waiting    Wait until FIFO is not full
+ *
+ * @return    zero on success, nonzero otherwise
+ *
+ ****************************************************************************/
+int spsc_fifo_put(spsc_fifo_t *fifo, void *item, bool is_waiting)
+{
+    uint32_t wr = __atomic_load_n(&fifo->wr, __ATOMIC_RELAXED);
+    uint32_t rd = __atomic_load_n(&fifo->rd, __ATOMIC_ACQUIRE);
+
+    while (wr - rd >= (uint32_t)fifo->size)
+    {
+        if (!is_waiting)
+            return -1;
+
+        /* Register first, then re-check, the consumer either sees us or we see it */
+        __atomic_fetch_add(&fifo->nf_waiters, 1, __ATOMIC_SEQ_CST);
+        rd = __atomic_load_n(&fifo->rd, __ATOMIC_SEQ_CST);
+        if (wr - rd >= (uint32_t)fifo->size)
+            futex_wait(&fifo->rd, rd, NULL);
+        __atomic_fetch_sub(&fifo->nf_waiters, 1, __ATOMIC_RELAXED);
+
+        rd = __atomic_load_n(&fifo->rd, __ATOMIC_ACQUIRE);
+    }
+
+    fifo->data[wr & fifo->mask] = item;
+    __atomic_store_n(&fifo->wr, wr + 1, __ATOMIC_SEQ_CST);
+
+    if (__atomic_load_n(&fifo->ne_waiters, __ATOMIC_SEQ_CST) != 0)
+        futex_wake(&fifo->wr);
+
+    return 0;
+}
+
+
+/*************************************************************************//**
+ * Remove item from FIFO
+ *
+ * Must be called from the consumer thread only.
+ *
+ * @param[in,out]    fifo          FIFO context
+ * @param[in,out]    item          Storage for removed item
+ * @param[in]        is_waiting    Wait until FIFO is not empty
+ *
+ * @return    zero on success, nonzero otherwise
+ *
+ ****************************************************************************/
+int spsc_fifo_get(spsc_fifo_t *fifo, void **item, bool is_waiting)
+{
+    return spsc_fifo_get_timed(fifo, item, is_waiting ? -1 : 0);
+}
+
+
+/*************************************************************************//**
+ * Remove item from FIFO, wait limited time
+ *
+ * Must be called from the consumer thread only.
+ *
+ * @param[in,out]    fifo          FIFO context
+ * @param[in,out]    item          Storage for removed item
+ * @param[in]        timeout_ms    Wait at most this long until FIFO is not
+ *                                 empty (0: do not wait, <0: forever)
+ *
+ * @return    zero on success, nonzero otherwise (timeout)
+ *
+ ****************************************************************************/
+int spsc_fifo_get_timed(spsc_fifo_t *fifo, void **item, int timeout_ms)
+{
+    uint32_t rd    = __atomic_load_n(&fifo->rd, __ATOMIC_RELAXED);
+    uint32_t wr    = __atomic_load_n(&fifo->wr, __ATOMIC_ACQUIRE);
+    uint64_t until = 0;
+
+    if ((wr == rd) && (timeout_ms > 0))
+        until = get_ns() + timeout_ms * 1000000ULL;
+
+    while (wr == rd)
+    {
+        struct timespec  ts;
+        struct timespec *timeout = NULL;
+
+        if (timeout_ms == 0)
+            return -1;
+
+        /* futex takes the remaining time, wake-ups might be spurious */
+        if (timeout_ms > 0)
+        {
+            uint64_t now = get_ns();
+
+            if (now >= until)
+                return -1;
+
+            ts.tv_sec  = (until - now) / 1000000000ULL;
+            ts.tv_nsec = (until - now) % 1000000000ULL;
+            timeout    = &ts;
+        }
+
+        /* Register first, then re-check, the producer either sees us or we see it */
+        __atomic_fetch_add(&fifo->ne_waiters, 1, __ATOMIC_SEQ_CST);
+        wr = __atomic_load_n(&fifo->wr, __ATOMIC_SEQ_CST);
+        if (wr == rd)
+            futex_wait(&fifo->wr, wr, timeout);
+        __atomic_fetch_sub(&fifo->ne_waiters, 1, __ATOMIC_RELAXED);
+
+        wr = __atomic_load_n(&fifo->wr, __ATOMIC_ACQUIRE);
+    }
+
+    *item = fifo->data[rd & fifo->mask];
+    __atomic_store_n(&fifo->rd, rd + 1, __ATOMIC_SEQ_CST);
+
+    if (__atomic_load_n(&fifo->nf_waiters, __ATOMIC_SEQ_CST) != 0)
+        futex_wake(&fifo->rd);
+
+    return 0;
+}
+
+
+/*************************************************************************//**
+ * Get number of items in FIFO
+ *
+ * Might be called from any thread, the value is just a snapshot.
+ *
+ * @param[in]    fifo    FIFO context
+ *
+ * @return    number of items
+ *
+ ****************************************************************************/
+int spsc_fifo_count(spsc_fifo_t *fifo)
+{
+    uint32_t rd = __atomic_load_n(&fifo->rd, __ATOMIC_RELAXED);
+    uint32_t wr = __atomic_load_n(&fifo->wr, __ATOMIC_RELAXED);
+
+    return (int)(wr - rd);
+}
+
+
+/*****************************************************************************
+ * End of file
+ ****************************************************************************/
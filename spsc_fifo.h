@@ -0,0 +1,61 @@
+/*************************************************************************//**
+ * @file spsc_fifo.h
+ *
+ *     Lock-free single producer / single consumer FIFO
+ *
+ ****************************************************************************/
+#ifndef __SPSC_FIFO_H__
+#define __SPSC_FIFO_H__
+
+#include <stdint.h>
+#include <stdbool.h>
+
+
+/*****************************************************************************
+ * Public macros
+ ****************************************************************************/
+#define SPSC_FIFO_ALIGN 64  /**< Cache line size, keeps both ends apart */
+
+
+/*****************************************************************************
+ * Public types
+ ****************************************************************************/
+
+
+/**
+ * SPSC FIFO context
+ *
+ * Indices run freely (never wrapped to the size), the slot is picked by mask,
+ * so neither of the ends needs any division. Each end is touched by one
+ * thread only, so they live in separate cache lines.
+ */
+typedef struct spsc_fifo_tt
+{
+    int               size;
+    uint32_t          mask;
+    void            **data;
+    char             *name;
+
+    uint32_t          wr __attribute__((aligned(SPSC_FIFO_ALIGN)));
+    uint32_t          ne_waiters;
+
+    uint32_t          rd __attribute__((aligned(SPSC_FIFO_ALIGN)));
+    uint32_t          nf_waiters;
+} spsc_fifo_t;
+
+
+/*****************************************************************************
+ * Public prototypes
+ ****************************************************************************/
+void spsc_fifo_init (spsc_fifo_t *fifo, int size, char *name);
+void spsc_fifo_done (spsc_fifo_t *fifo);
+int  spsc_fifo_put  (spsc_fifo_t *fifo, void *item, bool is_waiting);
+int  spsc_fifo_get  (spsc_fifo_t *fifo, void **item, bool is_waiting);
+int  spsc_fifo_get_timed(spsc_fifo_t *fifo, void **item, int timeout_ms);
+int  spsc_fifo_count(spsc_fifo_t *fifo);
+
+
+#endif
+/*****************************************************************************
+ * End of file
+ ****************************************************************************/
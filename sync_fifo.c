@@ -6,6 +6,7 @@
  ****************************************************************************/
 #include <stdio.h>
 #include <stdbool.h>
+#include <time.h>
 #include <pthread.h>
 #include "fifo.h"
 #include "sync_fifo.h"
@@ -26,10 +27,17 @@
  ****************************************************************************/
 void sync_fifo_init(sync_fifo_t *fifo, int size, char *name)
 {
+    pthread_condattr_t attr;
+
     fifo->name = name;
     fifo_init(&fifo->raw, size);
     pthread_mutex_init(&fifo->mx, NULL);
-    pthread_cond_init(&fifo->cv_ne, NULL);
+
+    /* Timed waits measured as the frames are, immune to wall clock changes */
+    pthread_condattr_init(&attr);
+    pthread_condattr_setclock(&attr, CLOCK_MONOTONIC);
+    pthread_cond_init(&fifo->cv_ne, &attr);
+    pthread_condattr_destroy(&attr);
     pthread_cond_init(&fifo->cv_nf, NULL);
 }
 
@@ -97,15 +105,46 @@ int sync_fifo_put(sync_fifo_t *fifo, void *item, bool is_waiting)
  ****************************************************************************/
 int sync_fifo_get(sync_fifo_t *fifo, void **item, bool is_waiting)
 {
-    int ret = 0;
+    return sync_fifo_get_timed(fifo, item, is_waiting ? -1 : 0);
+}
+
+
+/*************************************************************************//**
+ * Remove item from FIFO, wait limited time
+ *
+ * @param[in,out]    fifo          FIFO context
+ * @param[in,out]    item          Storage for removed item
+ * @param[in]        timeout_ms    Wait at most this long until FIFO is not
+ *                                 empty (0: do not wait, <0: forever)
+ *
+ * @return    zero on success, nonzero otherwise (timeout)
+ *
+ ****************************************************************************/
+int sync_fifo_get_timed(sync_fifo_t *fifo, void **item, int timeout_ms)
+{
+    struct timespec ts;
+    int             ret = 0;
+
+    if (timeout_ms > 0)
+    {
+        clock_gettime(CLOCK_MONOTONIC, &ts);
+        ts.tv_sec  += timeout_ms / 1000;
+        ts.tv_nsec += (timeout_ms % 1000) * 1000000L;
+        if (ts.tv_nsec >= 1000000000L)
+        {
+            ts.tv_sec  += 1;
+            ts.tv_nsec -= 1000000000L;
+        }
+    }
 
     pthread_mutex_lock(&fifo->mx);
     {
         while (FIFO_EMPTY(fifo->raw))
         {
-            if (is_waiting)
+            if (timeout_ms < 0)
                 pthread_cond_wait(&fifo->cv_ne, &fifo->mx);
-            else
+            else if (   (timeout_ms == 0)
+                     || (pthread_cond_timedwait(&fifo->cv_ne, &fifo->mx, &ts) != 0))
             {
                 pthread_mutex_unlock(&fifo->mx);
                 return -1;
@@ -121,6 +160,26 @@ int sync_fifo_get(sync_fifo_t *fifo, void **item, bool is_waiting)
 }
 
 
+/*************************************************************************//**
+ * Get number of items in FIFO
+ *
+ * @param[in,out]    fifo    FIFO context
+ *
+ * @return    number of items
+ *
+ ****************************************************************************/
+int sync_fifo_count(sync_fifo_t *fifo)
+{
+    int count;
+
+    pthread_mutex_lock(&fifo->mx);
+    count = FIFO_COUNT(fifo->raw);
+    pthread_mutex_unlock(&fifo->mx);
+
+    return count;
+}
+
+
 /*****************************************************************************
  * End of file
  ****************************************************************************/
@@ -37,6 +37,8 @@ void sync_fifo_init(sync_fifo_t *fifo, int size, char *name);
 void sync_fifo_done(sync_fifo_t *fifo);
 int  sync_fifo_put (sync_fifo_t *fifo, void *item, bool is_waiting);
 int  sync_fifo_get (sync_fifo_t *fifo, void **item, bool is_waiting);
+int  sync_fifo_get_timed(sync_fifo_t *fifo, void **item, int timeout_ms);
+int  sync_fifo_count(sync_fifo_t *fifo);
 
 
 #endif